@@ -0,0 +1,619 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Hot path microbenchmarks, run without the INDI framework:
+//   focuserlink_bench [iterations [link delay ms]]
+//   focuserlink_bench -R transcript
+// Parser and settings benchmarks compare with the string based code the
+// driver used before, allocations are counted by replacing operator new. The
+// session benchmark polls through FocuserLinkIO with a stub transport
+// answering at once. The poll cycle benchmark talks to an in-process emulator
+// over a pty, the connect benchmark measures how long the first q, u and f
+// take, the reactor benchmark polls 1, 4 and 16 emulators from the shared
+// I/O reactor. The transport rows time one q on the device model in
+// process and over a pty with the port on top. With -R a recorded transcript
+// is replayed through a session as fast as the reactor takes it.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <new>
+#include <poll.h>
+#include <regex>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "focuserlink_protocol.h"
+#include "focuserlink_port.h"
+#include "focuserlink_emulator.h"
+#include "focuserlink_io.h"
+#include "focuserlink_schema.h"
+#include "focuserlink_transcript.h"
+#include "focuserlink_trace.h"
+#include "focuserlink_filter.h"
+#include "focuserlink_transport.h"
+
+static const char *Q_REPLY = "q:12345:-250:1:12.45:67.80:6.52:-14";
+static const char *U_REPLY = "u:25000:220:0:100:40000:0:500:1250:30:10:1:0:0:1:0:0";
+static const char *F_REPLY = "f:1";
+
+static volatile double sink = 0;
+
+static std::atomic<long> allocations { 0 };
+
+// kept out of line, inlined into containers GCC takes free() for a mismatch
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// regex based split() as used by the driver before the zero-allocation parser
+static std::vector<std::string> legacySplit(const std::string &input, const std::string &regex)
+{
+    std::regex re(regex);
+    std::sregex_token_iterator
+        first{input.begin(), input.end(), re, -1},
+        last;
+    return {first, last};
+}
+
+// double formatting and settings map as used by updateSettings() before the schema
+static std::string legacyDoubleToStr(double val)
+{
+    char buf[10];
+    sprintf(buf, "%.0f", val);
+    return std::string(buf);
+}
+
+static bool legacySettingsCommand(char *cmd)
+{
+    std::map<int, std::string> updates;
+    updates[U_STEPSIZE] = legacyDoubleToStr(5.25 * 100.0);
+    updates[U_COMPCYCLE] = "30";
+    updates[U_COMPSTEP] = legacyDoubleToStr(-12.5 * 100.0);
+    updates[U_COMPTRIGGER] = legacyDoubleToStr(10);
+
+    int indices[SCHEMA_MAX_PATCHES];
+    const char *values[SCHEMA_MAX_PATCHES];
+    int n = 0;
+    for (std::map<int, std::string>::iterator it = updates.begin(); it != updates.end(); ++it, ++n)
+    {
+        indices[n] = it->first;
+        values[n] = it->second.c_str();
+    }
+    return FocuserLinkProtocol::formatPatched(U_REPLY, 'U', indices, values, n, cmd, ASTROLINK4_LEN);
+}
+
+static bool settingsCommand(char *cmd)
+{
+    FocuserLinkSchema::SettingsPatch patch;
+    patch.set<&FocuserLinkProtocol::URecord::stepSize>(5.25);
+    patch.set<&FocuserLinkProtocol::URecord::compCycle>(30);
+    patch.set<&FocuserLinkProtocol::URecord::compStep>(-12.5);
+    patch.set<&FocuserLinkProtocol::URecord::compTrigger>(10);
+
+    const char *values[SCHEMA_MAX_PATCHES];
+    for (int i = 0; i < patch.count; i++)
+        values[i] = patch.value[i];
+    return FocuserLinkProtocol::formatPatched(U_REPLY, 'U', patch.index, values, patch.count, cmd, ASTROLINK4_LEN);
+}
+
+template <typename F>
+static void run(const char *name, long iterations, F body)
+{
+    long allocated = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+        body();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("%-28s %10.1f ns/op %8.2f allocs/op\n", name, static_cast<double>(elapsed) / iterations,
+           static_cast<double>(allocations.load() - allocated) / iterations);
+}
+
+// a single q on the layers below the session, the device model alone and the pty line with port and emulator thread
+static void transportLayers(long iterations)
+{
+    FocuserLinkMemoryTransport memory;
+    memory.open();
+    run("transport memory q", iterations, [&memory]()
+    {
+        char res[ASTROLINK4_LEN];
+        sink = memory.exchange("q", res);
+    });
+
+    FocuserLinkPtyTransport pty;
+    if (!pty.open())
+    {
+        perror("pty");
+        return;
+    }
+    FocuserLinkPort port;
+    port.attach(pty.fd());
+    const int exchanges = 2000;
+    int failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < exchanges; i++)
+    {
+        char res[ASTROLINK4_LEN];
+        failed += (port.exchange("q", res, 1000) == FocuserLinkPort::PORT_OK) ? 0 : 1;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("%-28s %10.1f ns/op  (%d exchanges, %d failed)\n", "transport pty q + port", static_cast<double>(elapsed) / exchanges,
+           exchanges, failed);
+}
+
+// one q/u/f poll cycle, exchanged one by one or written back to back
+static bool pollCycle(FocuserLinkPort &port, bool pipelined)
+{
+    static const char *const cmds[] = { "q", "u", "f" };
+    char res[3][ASTROLINK4_LEN];
+    if (pipelined)
+    {
+        FocuserLinkPort::Result rc[3];
+        uint32_t micros[3];
+        static const int timeouts[] = { 1000, 1000, 1000 };
+        return port.transact(cmds, res, rc, micros, 3, timeouts) == FocuserLinkPort::PORT_OK;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (port.exchange(cmds[i], res[i], 1000) != FocuserLinkPort::PORT_OK)
+            return false;
+    }
+    return true;
+}
+
+static void pollCycles(int linkDelayMs)
+{
+    FocuserLinkEmulator emulator;
+    emulator.linkDelayMs = linkDelayMs;
+    if (!emulator.open())
+    {
+        perror("pty");
+        return;
+    }
+    std::atomic<bool> stop { false };
+    std::thread server([&]()
+    {
+        emulator.run(stop);
+    });
+
+    int fd = open(emulator.slaveName().c_str(), O_RDWR | O_NOCTTY);
+    FocuserLinkPort port;
+    port.attach(fd);
+
+    const int cycles = (linkDelayMs > 0) ? 2000 / linkDelayMs : 2000;
+    for (int pipelined = 0; pipelined < 2; pipelined++)
+    {
+        int failed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < cycles; i++)
+            failed += pollCycle(port, pipelined) ? 0 : 1;
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        printf("%-28s %10.3f ms/cycle  (%d cycles, %d failed)\n", pipelined ? "poll cycle pipelined" : "poll cycle sequential",
+               elapsed / 1000.0 / cycles, cycles, failed);
+    }
+
+    close(fd);
+    stop = true;
+    server.join();
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Poll cycles through a session with an Exchange stub that answers at once,
+// the reactor runs them back to back. Timed by CPU, so the reactor's own waits
+// do not count, the INDI side draining the events is included. Every q, u and f
+// exchange publishes one event; the stub holds the reactor back while the
+// queue is half full so none is dropped and each cycle pays for its event.
+static bool sessionCycles()
+{
+    const int durationMs = 1000;
+    const long backlog = IO_QUEUE_SIZE / 2;
+    std::atomic<long> cycles { 0 };
+    std::atomic<long> published { 0 };
+    std::atomic<long> received { 0 };
+    std::atomic<bool> finished { false };
+    FocuserLinkIO session([&](const char *cmd, char *res)
+    {
+        switch (cmd[0])
+        {
+            case 'q':
+                while (published.load() - received.load() >= backlog && !finished)
+                    std::this_thread::sleep_for(std::chrono::microseconds(20));
+                cycles++;
+                published++;
+                snprintf(res, ASTROLINK4_LEN, "%s", Q_REPLY);
+                break;
+            case 'u':
+                published++;
+                snprintf(res, ASTROLINK4_LEN, "%s", U_REPLY);
+                break;
+            case 'f':
+                published++;
+                snprintf(res, ASTROLINK4_LEN, "%s", F_REPLY);
+                break;
+            default:
+                snprintf(res, ASTROLINK4_LEN, "%c", cmd[0]);
+        }
+        return true;
+    });
+    session.setPolling(0, 0, 0, 0);
+
+    double cpuStart = cpuSeconds();
+    long allocated = allocations.load();
+    if (!session.start())
+        return false;
+
+    FocuserLinkEvent event;
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(durationMs);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        struct pollfd pfd = { session.notifyFD(), POLLIN, 0 };
+        poll(&pfd, 1, 10);
+        session.clearNotify();
+        while (session.nextEvent(event))
+            received++;
+    }
+    finished = true;
+    session.stop();
+    while (session.nextEvent(event))
+        received++;
+
+    double cpu = cpuSeconds() - cpuStart;
+    long n = std::max(cycles.load(), 1L);
+    long dropped = static_cast<long>(session.droppedEvents());
+    printf("%-28s %10.1f ns/op %8.2f allocs/op  (%ld q/u/f cycles, %ld of %ld events)\n", "session poll cycle (stub)",
+           cpu * 1e9 / n, static_cast<double>(allocations.load() - allocated) / n, n, received.load(), published.load());
+    if (received.load() != published.load() || dropped != 0)
+    {
+        fprintf(stderr, "session poll cycle: %ld events published, %ld received, %ld dropped\n", published.load(),
+                received.load(), dropped);
+        return false;
+    }
+    return true;
+}
+
+// Recorded exchanges fed to a session with polling unthrottled, until the
+// first command letter runs out of replies
+static int replaySession(const char *path)
+{
+    FocuserLinkReplay replay;
+    if (!replay.load(path))
+    {
+        fprintf(stderr, "Cannot load transcript %s\n", path);
+        return 1;
+    }
+
+    std::atomic<long> served { 0 };
+    std::atomic<bool> exhausted { false };
+    FocuserLinkIO session([&](const char *cmd, char *res)
+    {
+        const FocuserLinkExchange *exchange = replay.next(cmd);
+        if (exchange == nullptr)
+        {
+            exhausted = true;
+            return false;
+        }
+        served++;
+        snprintf(res, ASTROLINK4_LEN, "%s", exchange->reply);
+        return exchange->result == FocuserLinkExchange::EXCHANGE_OK;
+    });
+    session.setPolling(0, 0, 0, 0);
+
+    double cpuStart = cpuSeconds();
+    auto wallStart = std::chrono::steady_clock::now();
+    long allocated = allocations.load();
+    if (!session.start())
+        return 1;
+
+    long events = 0;
+    while (!exhausted)
+    {
+        struct pollfd pfd = { session.notifyFD(), POLLIN, 0 };
+        poll(&pfd, 1, 10);
+        session.clearNotify();
+        FocuserLinkEvent event;
+        while (session.nextEvent(event))
+            events++;
+    }
+    session.stop();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    double cpu = cpuSeconds() - cpuStart;
+    long n = std::max(served.load(), 1L);
+    printf("%zu recorded exchanges, %ld replayed in %.3f s\n", replay.size(), served.load(), wall);
+    printf("%-28s %10.1f ns/op %8.2f allocs/op  (%ld events)\n", "replayed exchange", cpu * 1e9 / n,
+           static_cast<double>(allocations.load() - allocated) / n, events);
+    return 0;
+}
+
+// Time from session start, right after the handshake, until position, u and
+// f have arrived, i.e. until all properties are populated without the cache
+static void connectLatency(int linkDelayMs)
+{
+    const int rounds = 20;
+    double sums[3] = { 0, 0, 0 };
+    for (int round = 0; round < rounds; round++)
+    {
+        FocuserLinkEmulator emulator;
+        emulator.linkDelayMs = linkDelayMs;
+        if (!emulator.open())
+        {
+            perror("pty");
+            return;
+        }
+        std::atomic<bool> stop { false };
+        std::thread server([&emulator, &stop]()
+        {
+            emulator.run(stop);
+        });
+        FocuserLinkPort port;
+        port.attach(open(emulator.slaveName().c_str(), O_RDWR | O_NOCTTY));
+        FocuserLinkIO session([](const char *, char *)
+        {
+            return false;
+        });
+        session.setPort(&port, nullptr);
+
+        auto start = std::chrono::steady_clock::now();
+        session.start();
+        double seen[3] = { -1, -1, -1 };
+        while ((seen[0] < 0 || seen[1] < 0 || seen[2] < 0) && std::chrono::steady_clock::now() - start < std::chrono::seconds(2))
+        {
+            struct pollfd pfd = { session.notifyFD(), POLLIN, 0 };
+            poll(&pfd, 1, 10);
+            session.clearNotify();
+            FocuserLinkEvent event;
+            while (session.nextEvent(event))
+            {
+                int slot = (event.type == FocuserLinkEvent::EVENT_Q) ? 0 : (event.type == FocuserLinkEvent::EVENT_U) ? 1 :
+                           (event.type == FocuserLinkEvent::EVENT_F) ? 2 : -1;
+                if (slot >= 0 && seen[slot] < 0)
+                    seen[slot] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+        session.stop();
+        stop = true;
+        server.join();
+        close(port.fd());
+        for (int i = 0; i < 3; i++)
+            sums[i] += seen[i];
+    }
+    printf("%-28s q %.2f ms  u %.2f ms  f %.2f ms  (cached settings are shown at handshake)\n", "connect to populated",
+           sums[0] / rounds, sums[1] / rounds, sums[2] / rounds);
+}
+
+// N devices polled every 50 ms by sessions sharing the reactor thread
+static void reactorScaling(int units, int linkDelayMs)
+{
+    const int durationMs = 2000;
+    std::vector<std::unique_ptr<FocuserLinkEmulator>> emulators;
+    std::vector<std::unique_ptr<FocuserLinkPort>> ports;
+    std::vector<std::unique_ptr<FocuserLinkIO>> sessions;
+    std::vector<std::thread> servers;
+    std::atomic<bool> stop { false };
+
+    for (int i = 0; i < units; i++)
+    {
+        emulators.emplace_back(new FocuserLinkEmulator());
+        emulators[i]->linkDelayMs = linkDelayMs;
+        if (!emulators[i]->open())
+        {
+            perror("pty");
+            return;
+        }
+        FocuserLinkEmulator *emulator = emulators[i].get();
+        servers.emplace_back([emulator, &stop]()
+        {
+            emulator->run(stop);
+        });
+
+        ports.emplace_back(new FocuserLinkPort());
+        ports[i]->attach(open(emulators[i]->slaveName().c_str(), O_RDWR | O_NOCTTY));
+        sessions.emplace_back(new FocuserLinkIO([](const char *, char *)
+        {
+            return false;
+        }));
+        sessions[i]->setPort(ports[i].get(), nullptr);
+        sessions[i]->setPolling(50, 50, POLL_ENVIRONMENT, POLL_SETTINGS);
+    }
+
+    double cpuStart = cpuSeconds();
+    for (auto &session : sessions)
+        session->start();
+
+    // INDI side: count position updates and the largest gap between them
+    std::vector<long> updates(units, 0);
+    std::vector<double> maxGap(units, 0);
+    std::vector<std::chrono::steady_clock::time_point> last(units, std::chrono::steady_clock::now());
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(durationMs);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        std::vector<struct pollfd> fds;
+        for (auto &session : sessions)
+            fds.push_back({ session->notifyFD(), POLLIN, 0 });
+        poll(fds.data(), fds.size(), 10);
+        for (int i = 0; i < units; i++)
+        {
+            sessions[i]->clearNotify();
+            FocuserLinkEvent event;
+            while (sessions[i]->nextEvent(event))
+            {
+                if (event.type != FocuserLinkEvent::EVENT_Q)
+                    continue;
+                auto now = std::chrono::steady_clock::now();
+                if (updates[i]++ > 0)
+                    maxGap[i] = std::max(maxGap[i], std::chrono::duration<double, std::milli>(now - last[i]).count());
+                last[i] = now;
+            }
+        }
+    }
+    double cpu = cpuSeconds() - cpuStart;
+
+    for (auto &session : sessions)
+        session->stop();
+    stop = true;
+    for (auto &server : servers)
+        server.join();
+    for (auto &port : ports)
+        close(port->fd());
+
+    long total = 0;
+    double worstGap = 0;
+    for (int i = 0; i < units; i++)
+    {
+        total += updates[i];
+        worstGap = std::max(worstGap, maxGap[i]);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "reactor %d device%s", units, units > 1 ? "s" : "");
+    printf("%-28s %10.1f polls/s/device  max gap %.1f ms  cpu %.1f%% (emulators included)\n", name,
+           total * 1000.0 / durationMs / units, worstGap, cpu * 100000.0 / durationMs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 && !strcmp(argv[1], "-R"))
+        return replaySession(argv[2]);
+
+    long iterations = (argc > 1) ? atol(argv[1]) : 200000;
+    if (iterations <= 0)
+        iterations = 200000;
+    int linkDelayMs = (argc > 2) ? atoi(argv[2]) : 2;
+
+    printf("%ld iterations\n", iterations);
+
+    run("split q + stod", iterations, []()
+    {
+        std::vector<std::string> result = legacySplit(Q_REPLY, ":");
+        sink = std::stod(result[Q_STEPPER_POS]) + std::stod(result[Q_STEPS_TO_GO]) + std::stod(result[Q_SENS1_TEMP]) +
+               std::stod(result[Q_SENS1_HUM]) + std::stod(result[Q_SENS1_DEW]) + std::stod(result[Q_COMP_DIFF]);
+    });
+    run("parseQ", iterations, []()
+    {
+        FocuserLinkProtocol::QRecord q;
+        if (FocuserLinkProtocol::parseQ(Q_REPLY, q))
+            sink = q.stepperPos + q.stepsToGo + q.sens1Temp + q.sens1Hum + q.sens1Dew + q.compDiff;
+    });
+
+    run("split u + stod", iterations, []()
+    {
+        std::vector<std::string> result = legacySplit(U_REPLY, ":");
+        sink = std::stod(result[U_STEPSIZE]) + std::stod(result[U_COMPSTEP]) + std::stod(result[U_COMPTRIGGER]) +
+               std::stod(result[U_MAX_POS]) + std::stod(result[U_COMPAUTO]);
+    });
+    run("parseU", iterations, []()
+    {
+        FocuserLinkProtocol::URecord u;
+        if (FocuserLinkProtocol::parseU(U_REPLY, u))
+            sink = u.stepSize + u.compStep + u.compTrigger + u.maxPos + u.compAuto;
+    });
+
+    run("split f + stod", iterations, []()
+    {
+        std::vector<std::string> result = legacySplit(F_REPLY, ":");
+        sink = std::stod(result[F_MANUAL]);
+    });
+    run("parseF", iterations, []()
+    {
+        FocuserLinkProtocol::FRecord f;
+        if (FocuserLinkProtocol::parseF(F_REPLY, f))
+            sink = f.manual;
+    });
+
+    run("doubleToStr", iterations, []()
+    {
+        sink = legacyDoubleToStr(-1250.0).size();
+    });
+    run("SettingsPatch::set", iterations, []()
+    {
+        FocuserLinkSchema::SettingsPatch patch;
+        sink = patch.set<&FocuserLinkProtocol::URecord::compStep>(-12.5);
+    });
+
+    run("settings command map", iterations, []()
+    {
+        char cmd[ASTROLINK4_LEN];
+        sink = legacySettingsCommand(cmd);
+    });
+    run("settings command schema", iterations, []()
+    {
+        char cmd[ASTROLINK4_LEN];
+        sink = settingsCommand(cmd);
+    });
+
+    // per exchange cost of the always on trace next to the debug log formatting it replaced
+    run("debug log snprintf", iterations, []()
+    {
+        char line[2 * ASTROLINK4_LEN];
+        sink = snprintf(line, sizeof(line), "CMD %s RES %s", "q", Q_REPLY);
+    });
+    FocuserLinkTrace trace;
+    run("trace record", iterations, [&trace]()
+    {
+        trace.record(FocuserLinkTraceEntry::TRACE_EXCHANGE, 'q', 0, 1250, 2, 37);
+    });
+
+    FocuserLinkFilter filter;
+    filter.configure(0.3, FILTER_MAX_WINDOW);
+    long sample = 0;
+    run("weather filter full window", iterations, [&filter, &sample]()
+    {
+        sample++;
+        filter.add(sample * 5.0, 10.0 + (sample * 7919 % 100) / 100.0);
+        sink = filter.median() + filter.ema() + filter.min() + filter.max() + filter.rate();
+    });
+
+    transportLayers(iterations);
+    bool sessionOk = sessionCycles();
+
+    printf("link delay %d ms\n", linkDelayMs);
+    pollCycles(linkDelayMs);
+    connectLatency(linkDelayMs);
+    for (int units : { 1, 4, 16 })
+        reactorScaling(units, linkDelayMs);
+
+    return sessionOk ? 0 : 1;
+}
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Headless front end over libfocuserlink, talks to a controller without INDI:
+//   focuserlink_cli [-b baud] [-p poll ms] [-s] [-v] <line> <command> [argument]
+// line is a serial port, "pty" for the emulator on a pseudo terminal or
+// "memory" for the device model answering in process. Commands:
+//   status             position, environment, settings and hand controller state
+//   move <position>    moves there and waits for the motor to stop
+//   sync <position>    sets the current position
+//   stop               stops the motor
+//   watch [seconds]    prints every position update, until Ctrl+C without seconds
+//   raw <command>      sends one command line and prints the reply
+// -s prints the serial round trip statistics at the end, -v every exchange.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <poll.h>
+#include <unistd.h>
+
+#include "focuserlink_client.h"
+#include "focuserlink_motion.h"
+#include "focuserlink_transport.h"
+
+// how long a command or the first readings may take [s]
+#define CLI_REPLY_TIMEOUT   5
+// longest move waited for [s]
+#define CLI_MOVE_TIMEOUT    600
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> terminated { false };
+
+static void onSignal(int)
+{
+    terminated = true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-b baud] [-p poll ms] [-s] [-v] <port|pty|memory> "
+            "<status|move N|sync N|stop|watch [s]|raw command>\n", name);
+}
+
+// Feeds session events to handle until it returns true. Completions run first,
+// a lost link or timeoutS without success ends the wait.
+static bool waitFor(FocuserLinkIO &session, double timeoutS, const std::function<bool(const FocuserLinkEvent &)> &handle)
+{
+    Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeoutS));
+    while (!terminated.load() && Clock::now() < end)
+    {
+        struct pollfd pfd = { session.notifyFD(), POLLIN, 0 };
+        poll(&pfd, 1, 100);
+        session.clearNotify();
+
+        FocuserLinkEvent event;
+        while (session.nextEvent(event))
+        {
+            if (event.type == FocuserLinkEvent::EVENT_DONE)
+                session.complete(event);
+            else if (event.type == FocuserLinkEvent::EVENT_LINK_LOST)
+            {
+                fprintf(stderr, "device stopped answering\n");
+                return false;
+            }
+            else if (event.type == FocuserLinkEvent::EVENT_FAILED)
+                fprintf(stderr, "command %c failed\n", event.command);
+            if (handle(event))
+                return true;
+        }
+    }
+    return false;
+}
+
+static void printQ(const FocuserLinkEvent &event)
+{
+    const FocuserLinkProtocol::QRecord &q = event.q;
+    printf("position %d  to go %d", q.stepperPos, q.stepsToGo + event.plannedSteps);
+    if (event.eta > 0)
+        printf("  eta %.1f s", event.eta);
+    if (q.hasEnvironment && q.sens1Type > 0)
+        printf("  temperature %.2f C  humidity %.1f %%  dew point %.2f C", q.sens1Temp, q.sens1Hum, q.sens1Dew);
+    if (q.hasEnvironment)
+        printf("  compensation %.0f", q.compDiff);
+    printf("\n");
+}
+
+static bool status(FocuserLinkIO &session)
+{
+    bool haveQ = false, haveU = false, haveF = false;
+    FocuserLinkEvent q, u, f;
+    // the first poll of a session reads everything
+    bool ok = waitFor(session, CLI_REPLY_TIMEOUT, [&](const FocuserLinkEvent &event)
+    {
+        if (event.type == FocuserLinkEvent::EVENT_Q && event.q.hasEnvironment)
+            haveQ = true, q = event;
+        else if (event.type == FocuserLinkEvent::EVENT_U)
+            haveU = true, u = event;
+        else if (event.type == FocuserLinkEvent::EVENT_F)
+            haveF = true, f = event;
+        return haveQ && haveU && haveF;
+    });
+    if (!ok)
+        return false;
+
+    printQ(q);
+    printf("max position %u  reversed %d  step size %.2f um  compensation %.2f steps/C every %.0f s above %.0f steps, %s\n",
+           u.u.maxPos, u.u.reversed ? 1 : 0, u.u.stepSize, u.u.compStep, u.u.compCycle, u.u.compTrigger,
+           u.u.compAuto ? "automatic" : "manual");
+    printf("hand controller %s\n", f.f.manual ? "on" : "off");
+    return true;
+}
+
+static bool move(FocuserLinkIO &session, uint32_t target)
+{
+    int32_t position = -1;
+    uint32_t maxPos = 0;
+    auto current = [&position, &maxPos](const FocuserLinkEvent &event)
+    {
+        if (event.type == FocuserLinkEvent::EVENT_Q)
+            position = event.q.stepperPos;
+        else if (event.type == FocuserLinkEvent::EVENT_U)
+            maxPos = event.u.maxPos;
+        return position >= 0 && maxPos > 0;
+    };
+    if (!waitFor(session, CLI_REPLY_TIMEOUT, current))
+        return false;
+    if (target > maxPos)
+    {
+        fprintf(stderr, "position %u beyond maximum %u\n", target, maxPos);
+        return false;
+    }
+
+    bool started = false, failed = false;
+    FocuserLinkMotionPlan plan = FocuserLinkMotion::plan(position, target, 0, maxPos);
+    // called once the last leg started
+    auto done = [&started, &failed](bool ok, const char *)
+    {
+        started = ok;
+        failed = !ok;
+    };
+    if (!session.submitMove(plan, done))
+        return false;
+    session.expectMotion();
+
+    auto arrived = [&started, &failed](const FocuserLinkEvent &event)
+    {
+        if (failed)
+            return true;
+        if (event.type != FocuserLinkEvent::EVENT_Q)
+            return false;
+        printQ(event);
+        return started && event.q.stepsToGo == 0 && event.plannedSteps == 0;
+    };
+    return waitFor(session, CLI_MOVE_TIMEOUT, arrived) && !failed;
+}
+
+// single command, reply printed when asked for
+static bool command(FocuserLinkIO &session, const char *cmd, bool print)
+{
+    bool done = false, ok = false;
+    char reply[ASTROLINK4_LEN] = {0};
+    auto answered = [&done, &ok, &reply](bool result, const char *res)
+    {
+        done = true;
+        ok = result;
+        snprintf(reply, sizeof(reply), "%s", res);
+    };
+    if (!session.submitCommand(cmd, answered))
+        return false;
+    auto finished = [&done](const FocuserLinkEvent &)
+    {
+        return done;
+    };
+    if (!waitFor(session, CLI_REPLY_TIMEOUT, finished) || !ok)
+        return false;
+    if (print)
+        printf("%s\n", reply);
+    return true;
+}
+
+static bool watch(FocuserLinkIO &session, double seconds)
+{
+    waitFor(session, seconds, [](const FocuserLinkEvent &event)
+    {
+        if (event.type == FocuserLinkEvent::EVENT_Q)
+            printQ(event);
+        return false;
+    });
+    return !terminated.load() || seconds > 0;
+}
+
+static void printStats(FocuserLinkStats &stats)
+{
+    printf("%-4s %10s %8s %8s %8s %8s %9s %9s %9s\n", "cmd", "count", "timeout", "framing", "error", "discard",
+           "p50 ms", "p99 ms", "max ms");
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+    {
+        FocuserLinkStats::Summary summary;
+        stats.summary(i, summary);
+        if (summary.count == 0 && summary.discarded == 0)
+            continue;
+        printf("%-4c %10llu %8llu %8llu %8llu %8llu %9.2f %9.2f %9.2f\n", FocuserLinkStats::commandAt(i),
+               (unsigned long long)summary.count, (unsigned long long)summary.timeouts,
+               (unsigned long long)summary.framing, (unsigned long long)summary.errors,
+               (unsigned long long)summary.discarded, summary.p50, summary.p99, summary.max);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int baud = TRANSPORT_DEFAULT_BAUD;
+    int pollMs = POLL_MOVING;
+    bool showStats = false, verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:p:svh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                baud = atoi(optarg);
+                break;
+            case 'p':
+                pollMs = atoi(optarg);
+                break;
+            case 's':
+                showStats = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 2 || pollMs <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *lineName = argv[optind];
+    const char *name = argv[optind + 1];
+    const char *argument = (argc - optind > 2) ? argv[optind + 2] : nullptr;
+
+    std::unique_ptr<FocuserLinkTransport> line;
+    if (!strcmp(lineName, "pty"))
+        line.reset(new FocuserLinkPtyTransport());
+    else if (!strcmp(lineName, "memory"))
+        line.reset(new FocuserLinkMemoryTransport());
+    else
+        line.reset(new FocuserLinkSerialTransport(lineName, baud));
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    FocuserLinkClient client(line.get());
+    FocuserLinkClient::Hooks hooks;
+    if (verbose)
+    {
+        hooks.exchanged = [](const char *cmd, const char *reply, Clock::time_point, uint32_t micros,
+                             FocuserLinkPort::Result rc)
+        {
+            fprintf(stderr, "%-16s -> %s (%.2f ms)\n", cmd, rc == FocuserLinkPort::PORT_OK ? reply :
+                    (rc == FocuserLinkPort::PORT_TIMEOUT ? "timeout" : "error"), micros / 1000.0);
+        };
+    }
+    client.setHooks(hooks);
+    FocuserLinkIO &session = client.session();
+    session.setPolling(pollMs, pollMs, POLL_ENVIRONMENT, POLL_SETTINGS);
+
+    switch (client.connect())
+    {
+        case FocuserLinkClient::CONNECT_OK:
+            break;
+        case FocuserLinkClient::CONNECT_OPEN_FAILED:
+            perror(lineName);
+            return 1;
+        case FocuserLinkClient::CONNECT_UNKNOWN_DEVICE:
+            fprintf(stderr, "%s: not a FocuserLink controller\n", lineName);
+            return 1;
+        default:
+            fprintf(stderr, "%s: no answer\n", lineName);
+            return 1;
+    }
+
+    char cmd[ASTROLINK4_LEN];
+    bool ok;
+    if (!strcmp(name, "status"))
+        ok = status(session);
+    else if (!strcmp(name, "move") && argument != nullptr)
+        ok = move(session, strtoul(argument, nullptr, 10));
+    else if (!strcmp(name, "sync") && argument != nullptr)
+        ok = FocuserLinkProtocol::formatSync(strtoul(argument, nullptr, 10), cmd, sizeof(cmd)) && command(session, cmd, false);
+    else if (!strcmp(name, "stop"))
+        ok = command(session, COMMAND_STOP, false);
+    else if (!strcmp(name, "watch"))
+        ok = watch(session, argument != nullptr ? atof(argument) : 1e9);
+    else if (!strcmp(name, "raw") && argument != nullptr)
+        ok = command(session, argument, true);
+    else
+    {
+        usage(argv[0]);
+        ok = false;
+    }
+
+    client.disconnect();
+    if (showStats)
+        printStats(client.stats());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_client.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+FocuserLinkClient::FocuserLinkClient(FocuserLinkTransport *transport) : transport(transport), io([this](const char *cmd,
+            char *res)
+{
+    return sendCommand(cmd, res);
+})
+{
+}
+
+FocuserLinkClient::~FocuserLinkClient()
+{
+    io.stop();
+}
+
+FocuserLinkClient::ConnectResult FocuserLinkClient::connect()
+{
+    if (transport == nullptr || (!transport->isOpen() && !transport->open()))
+        return CONNECT_OPEN_FAILED;
+
+    // start from a clean line, later exchanges never flush
+    transport->flush();
+    port.attach(transport->fd());
+    consecutiveFailures = 0;
+    linkLost = false;
+    batchDiscarded = 0;
+    // in process transports answer at once, lines are pipelined on the shared reactor
+    io.setPort(transport->fd() >= 0 ? &port : nullptr, [this](FocuserLinkPort & used, const char *const * cmds, int n)
+    {
+        reportBatch(used, cmds, n);
+    });
+
+    char res[ASTROLINK4_LEN] = {0};
+    if (!sendCommand(COMMAND_HANDSHAKE, res))
+        return CONNECT_NO_REPLY;
+    if (!FocuserLinkProtocol::isHandshake(res))
+        return CONNECT_UNKNOWN_DEVICE;
+    // from now on the line is owned by the session
+    return io.start() ? CONNECT_OK : CONNECT_NO_SESSION;
+}
+
+void FocuserLinkClient::disconnect()
+{
+    io.stop();
+    if (transport != nullptr)
+        transport->close();
+    port.attach(-1);
+}
+
+bool FocuserLinkClient::sendCommand(const char *cmd, char *res)
+{
+    Clock::time_point started = Clock::now();
+
+    if (transport->fd() < 0)
+    {
+        char reply[ASTROLINK4_LEN] = {0};
+        if (!transport->exchange(cmd, reply))
+            return commandFailed(cmd, started, FocuserLinkPort::PORT_ERROR);
+        exchanged(cmd, reply, started, 0, FocuserLinkPort::PORT_OK);
+        if (!res)
+            return true;
+        snprintf(res, ASTROLINK4_LEN, "%s", reply);
+    }
+    else
+    {
+        if (!res)
+        {
+            FocuserLinkPort::Result written = port.write(&cmd, 1);
+            exchanged(cmd, "", started, 0, written);
+            if (written != FocuserLinkPort::PORT_OK)
+                return commandFailed(cmd, started, FocuserLinkPort::PORT_ERROR);
+            recordCommand(cmd, started, FocuserLinkStats::RESULT_OK);
+            return true;
+        }
+
+        unsigned long discarded = port.discarded();
+        FocuserLinkPort::Result rc = port.exchange(cmd, res, FocuserLinkProtocol::replyTimeout(cmd[0]));
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+        exchanged(cmd, rc == FocuserLinkPort::PORT_OK ? res : "", started, elapsed, rc);
+        recordDiscarded(cmd[0], discarded);
+        if (rc != FocuserLinkPort::PORT_OK)
+            return commandFailed(cmd, started, rc);
+    }
+
+    if (cmd[0] != res[0])
+    {
+        recordCommand(cmd, started, FocuserLinkStats::RESULT_FRAMING);
+        if (hooks.failed)
+            hooks.failed(cmd[0], FocuserLinkStats::RESULT_FRAMING, 0);
+        return false;
+    }
+
+    recordCommand(cmd, started, FocuserLinkStats::RESULT_OK);
+    consecutiveFailures = 0;
+    return true;
+}
+
+void FocuserLinkClient::reportBatch(FocuserLinkPort &used, const char *const *cmds, int n)
+{
+    // runs on the reactor after a pipelined batch, the port is idle again
+    recordDiscarded(cmds[0][0], batchDiscarded);
+    batchDiscarded = used.discarded();
+
+    for (int i = 0; i < n; i++)
+    {
+        bool ok = used.result(i) == FocuserLinkPort::PORT_OK;
+        exchanged(cmds[i], ok ? used.reply(i) : "", used.startTime(), used.roundTrip(i), used.result(i));
+        if (ok)
+        {
+            serialStats.record(cmds[i][0], used.roundTrip(i), FocuserLinkStats::RESULT_OK);
+            consecutiveFailures = 0;
+        }
+        else
+            reportFailure(cmds[i][0], used.roundTrip(i), used.result(i));
+    }
+}
+
+void FocuserLinkClient::recordDiscarded(char command, unsigned long before)
+{
+    // replies are taken from the persistent receive buffer, stale frames are skipped there
+    if (port.discarded() != before)
+    {
+        serialStats.recordDiscarded(command, port.discarded() - before);
+        if (hooks.discarded)
+            hooks.discarded(command, port.discarded() - before);
+    }
+}
+
+void FocuserLinkClient::recordCommand(const char *cmd, Clock::time_point started, FocuserLinkStats::Result result)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+    serialStats.record(cmd[0], static_cast<uint32_t>(elapsed), result);
+}
+
+void FocuserLinkClient::exchanged(const char *cmd, const char *reply, Clock::time_point started, uint32_t micros,
+                                  FocuserLinkPort::Result rc)
+{
+    if (hooks.exchanged)
+        hooks.exchanged(cmd, reply, started, micros, rc);
+}
+
+bool FocuserLinkClient::commandFailed(const char *cmd, Clock::time_point started, FocuserLinkPort::Result rc)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+    reportFailure(cmd[0], static_cast<uint32_t>(elapsed), rc);
+    return false;
+}
+
+void FocuserLinkClient::reportFailure(char command, uint32_t micros, FocuserLinkPort::Result rc)
+{
+    if (rc == FocuserLinkPort::PORT_TIMEOUT)
+    {
+        serialStats.record(command, micros, FocuserLinkStats::RESULT_TIMEOUT);
+        if (hooks.failed)
+            hooks.failed(command, FocuserLinkStats::RESULT_TIMEOUT, 0);
+        if (++consecutiveFailures >= CLIENT_RESYNC_FAILURES && io.isRunning())
+            recoverLink();
+    }
+    else
+    {
+        int error = port.lastErrno();
+        serialStats.record(command, micros, FocuserLinkStats::RESULT_ERROR);
+        if (hooks.failed)
+            hooks.failed(command, FocuserLinkStats::RESULT_ERROR, error);
+        if (!io.isRunning())
+            return;
+        // unplugged adapter, hung up pty or a device no longer taking writes,
+        // flushing the line will not bring it back
+        if (error == EIO || error == ENXIO || error == ENODEV || error == ETIMEDOUT)
+        {
+            ++consecutiveFailures;
+            reportLinkLost();
+        }
+        else if (++consecutiveFailures >= CLIENT_RESYNC_FAILURES)
+            recoverLink();
+    }
+}
+
+void FocuserLinkClient::recoverLink()
+{
+    // runs on the reactor between batches, must not block the other devices
+    if (consecutiveFailures == CLIENT_RESYNC_FAILURES)
+    {
+        if (hooks.recovering)
+            hooks.recovering(RECOVERY_RESYNC, consecutiveFailures);
+        transport->flush();
+        port.attach(transport->fd());
+        batchDiscarded = 0;
+    }
+    else if (consecutiveFailures >= 2 * CLIENT_RESYNC_FAILURES)
+        reportLinkLost();
+}
+
+void FocuserLinkClient::reportLinkLost()
+{
+    // every batch fails until the front end reconnects, tell it once
+    if (!linkLost)
+    {
+        linkLost = true;
+        if (hooks.recovering)
+            hooks.recovering(RECOVERY_LINK_LOST, consecutiveFailures);
+        io.reportLinkLost();
+    }
+    consecutiveFailures = 0;
+}
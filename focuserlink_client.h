@@ -0,0 +1,132 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_CLIENT_H
+#define FOCUSERLINK_CLIENT_H
+
+#include <chrono>
+#include <functional>
+
+#include "focuserlink_io.h"
+#include "focuserlink_port.h"
+#include "focuserlink_stats.h"
+#include "focuserlink_transport.h"
+
+// consecutive failed exchanges (timeouts, I/O errors) before the line is
+// resynchronised, after twice as many the link is reported lost; a line that
+// went away (EIO, ENXIO, ENODEV) or stopped taking writes (ETIMEDOUT) is
+// reported lost at once
+#define CLIENT_RESYNC_FAILURES  3
+
+// Connection to one controller over any transport: handshake, the I/O session
+// polling the device, serial statistics and recovery from a silent line.
+// Front ends (the INDI driver, focuserlink_cli, the soak test) open it, feed
+// jobs to session() and read its events; the hooks let them log and trace
+// the traffic without the client knowing about either.
+class FocuserLinkClient
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum ConnectResult
+    {
+        CONNECT_OK = 0,
+        CONNECT_OPEN_FAILED,    // errno tells why
+        CONNECT_NO_REPLY,
+        CONNECT_UNKNOWN_DEVICE,
+        CONNECT_NO_SESSION
+    };
+
+    enum Recovery
+    {
+        RECOVERY_RESYNC,        // line flushed, receive buffer dropped
+        RECOVERY_LINK_LOST      // EVENT_LINK_LOST sent once per connection, the front end reconnects
+    };
+
+    // Hooks run on the thread doing the exchange, the reactor once the session
+    // is started. Any of them may be empty.
+    struct Hooks
+    {
+        // every command, reply is empty unless rc is PORT_OK, micros is 0 for writes without reply
+        std::function<void(const char *cmd, const char *reply, Clock::time_point started, uint32_t micros,
+                           FocuserLinkPort::Result rc)> exchanged;
+        // RESULT_TIMEOUT, RESULT_FRAMING or RESULT_ERROR with errno
+        std::function<void(char command, FocuserLinkStats::Result result, int error)> failed;
+        // stale or garbled frames skipped while waiting for the reply to command
+        std::function<void(char command, unsigned long frames)> discarded;
+        std::function<void(Recovery recovery, int failures)> recovering;
+    };
+
+    explicit FocuserLinkClient(FocuserLinkTransport *transport = nullptr);
+    ~FocuserLinkClient();
+
+    // only while disconnected
+    void setTransport(FocuserLinkTransport *transport)
+    {
+        this->transport = transport;
+    }
+    void setHooks(const Hooks &hooks)
+    {
+        this->hooks = hooks;
+    }
+
+    // opens the transport unless already open, checks the device answers as a
+    // FocuserLink controller and starts the session
+    ConnectResult connect();
+    // stops the session and closes the transport
+    void disconnect();
+    bool connected() const
+    {
+        return io.isRunning();
+    }
+
+    // blocking exchange, the session uses it for transports without descriptor,
+    // res nullptr writes without waiting for a reply
+    bool sendCommand(const char *cmd, char *res);
+
+    FocuserLinkIO &session()
+    {
+        return io;
+    }
+    FocuserLinkStats &stats()
+    {
+        return serialStats;
+    }
+
+private:
+    void reportBatch(FocuserLinkPort &used, const char *const *cmds, int n);
+    void recordDiscarded(char command, unsigned long before);
+    void recordCommand(const char *cmd, Clock::time_point started, FocuserLinkStats::Result result);
+    void exchanged(const char *cmd, const char *reply, Clock::time_point started, uint32_t micros,
+                   FocuserLinkPort::Result rc);
+    bool commandFailed(const char *cmd, Clock::time_point started, FocuserLinkPort::Result rc);
+    void reportFailure(char command, uint32_t micros, FocuserLinkPort::Result rc);
+    void recoverLink();
+    void reportLinkLost();
+
+    FocuserLinkTransport *transport;
+    Hooks hooks;
+    FocuserLinkPort port;
+    FocuserLinkIO io;
+    FocuserLinkStats serialStats;
+    int consecutiveFailures = 0;
+    bool linkLost = false;
+    unsigned long batchDiscarded = 0;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_compmodel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// fewer samples or a narrower temperature range say nothing about the slope
+#define COMP_MODEL_MIN_SAMPLES  5
+#define COMP_MODEL_MIN_SPREAD   0.5
+
+void FocuserLinkCompModel::add(double temperature, int32_t position, int filter)
+{
+    if (filter < 0 || filter >= COMP_MODEL_FILTERS)
+        filter = 0;
+    if (count == COMP_MODEL_WINDOW)
+        accumulate(window[next], -1);
+    else
+        count++;
+
+    window[next] = { temperature, position, filter };
+    accumulate(window[next], 1);
+    next = (next + 1) % COMP_MODEL_WINDOW;
+}
+
+void FocuserLinkCompModel::accumulate(const Sample &sample, int sign)
+{
+    Sums &s = sums[sample.filter];
+    double t = sample.temperature, p = sample.position;
+    s.n += sign;
+    s.t += sign * t;
+    s.p += sign * p;
+    s.tt += sign * t * t;
+    s.tp += sign * t * p;
+    s.pp += sign * p * p;
+}
+
+void FocuserLinkCompModel::shift(int32_t delta)
+{
+    for (int i = 0; i < count; i++)
+        window[i].position += delta;
+    for (int f = 0; f < COMP_MODEL_FILTERS; f++)
+    {
+        Sums &s = sums[f];
+        s.pp += 2 * delta * s.p + s.n * static_cast<double>(delta) * delta;
+        s.tp += delta * s.t;
+        s.p += s.n * static_cast<double>(delta);
+    }
+}
+
+void FocuserLinkCompModel::reset()
+{
+    next = count = 0;
+    memset(sums, 0, sizeof(sums));
+}
+
+FocuserLinkCompModel::Fit FocuserLinkCompModel::fit(bool perFilter) const
+{
+    Fit result = { false, 0, 0, 0, count, 0 };
+
+    // centred sums, within each filter or over all samples
+    double sxx = 0, sxy = 0, syy = 0;
+    int groups = 0;
+    Sums total = {};
+    for (int f = 0; f < COMP_MODEL_FILTERS; f++)
+    {
+        const Sums &s = sums[f];
+        if (s.n == 0)
+            continue;
+        if (perFilter)
+        {
+            sxx += s.tt - s.t * s.t / s.n;
+            sxy += s.tp - s.t * s.p / s.n;
+            syy += s.pp - s.p * s.p / s.n;
+            groups++;
+        }
+        total.n += s.n;
+        total.t += s.t;
+        total.p += s.p;
+        total.tt += s.tt;
+        total.tp += s.tp;
+        total.pp += s.pp;
+    }
+    if (!perFilter && total.n > 0)
+    {
+        sxx = total.tt - total.t * total.t / total.n;
+        sxy = total.tp - total.t * total.p / total.n;
+        syy = total.pp - total.p * total.p / total.n;
+        groups = 1;
+    }
+
+    // one degree of freedom per offset and one for the slope
+    int dof = count - groups - 1;
+    result.tempSpread = (count > 0 && sxx > 0) ? std::sqrt(sxx / count) : 0;
+    if (count < COMP_MODEL_MIN_SAMPLES || dof < 1 || result.tempSpread < COMP_MODEL_MIN_SPREAD)
+        return result;
+
+    result.slope = sxy / sxx;
+    result.r2 = (syy > 0) ? sxy * sxy / (sxx * syy) : 1.0;
+    double residual = std::max(syy - result.slope * sxy, 0.0);
+    result.stdErr = std::sqrt(residual / dof / sxx);
+    result.valid = true;
+    return result;
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_COMPMODEL_H
+#define FOCUSERLINK_COMPMODEL_H
+
+#include <stdint.h>
+
+// accepted focus positions the fit is based on, oldest are replaced
+#define COMP_MODEL_WINDOW       64
+// filters with an own focus offset, slot 0 is used without a filter wheel
+#define COMP_MODEL_FILTERS      16
+
+// Least squares fit of focus position against temperature,
+// position = slope * temperature + offset[filter]. Sums over a sliding window
+// of accepted positions are updated in constant time per sample. With common
+// terms every filter shares one offset, with per filter terms only the
+// position changes within a filter tell the slope.
+class FocuserLinkCompModel
+{
+public:
+    struct Fit
+    {
+        bool valid;         // enough samples spread over temperature
+        double slope;       // [steps/C]
+        double r2;          // share of position variance explained
+        double stdErr;      // [steps/C] of the slope
+        int samples;
+        double tempSpread;  // [C] standard deviation of the sample temperatures
+    };
+
+    void add(double temperature, int32_t position, int filter = 0);
+    // positions were renumbered by a sync
+    void shift(int32_t delta);
+    void reset();
+
+    Fit fit(bool perFilter) const;
+
+    int size() const
+    {
+        return count;
+    }
+
+private:
+    struct Sums
+    {
+        int n;
+        double t, p, tt, tp, pp;
+    };
+
+    struct Sample
+    {
+        double temperature;
+        int32_t position;
+        int filter;
+    };
+
+    void accumulate(const Sample &sample, int sign);
+
+    Sample window[COMP_MODEL_WINDOW];
+    int next = 0;
+    int count = 0;
+    Sums sums[COMP_MODEL_FILTERS] {};
+};
+
+#endif
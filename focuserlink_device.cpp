@@ -0,0 +1,194 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_device.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#define DEVICE_SETTINGS_COUNT   14
+
+FocuserLinkDevice::FocuserLinkDevice(const FocuserLinkDeviceConfig &config) : config(config)
+{
+    started = lastUpdate = Clock::now();
+    currentPos = config.position;
+    targetPos = config.position;
+    compReference = config.temperature;
+
+    settingsCount = DEVICE_SETTINGS_COUNT;
+    for (int i = 0; i < settingsCount; i++)
+        settings[i] = 0;
+    settings[U_MAX_POS] = config.maxPos;
+    settings[U_STEPSIZE] = std::round(config.stepSize * 100.0);
+    settings[U_COMPCYCLE] = 30;
+    settings[U_COMPTRIGGER] = 10;
+}
+
+bool FocuserLinkDevice::handle(const char *cmd, char *res, int len)
+{
+    double fields[FOCUSERLINK_MAX_FIELDS];
+    int count = FocuserLinkProtocol::parseFields(cmd, fields, FOCUSERLINK_MAX_FIELDS);
+
+    update();
+
+    switch ((count > 0) ? cmd[0] : 0)
+    {
+        case '#':
+            snprintf(res, len, "#:FocuserLink");
+            return true;
+
+        case 'q':
+            snprintf(res, len, "q:%d:%d:%d:%.2f:%.2f:%.2f:%d", position(), stepsToGo(), config.hasSensor ? 1 : 0,
+                     temperature(), config.humidity, dewPoint(), compensationDiff());
+            return true;
+
+        case 'u':
+        {
+            int n = snprintf(res, len, "u");
+            for (int i = 1; i < settingsCount && n < len; i++)
+                n += snprintf(res + n, len - n, ":%.0f", settings[i]);
+            return true;
+        }
+
+        case 'U':
+            setSettings(cmd);
+            snprintf(res, len, "U:");
+            return true;
+
+        case 'f':
+            snprintf(res, len, "f:%d", manual ? 1 : 0);
+            return true;
+
+        case 'F':
+            if (count > 1 && !std::isnan(fields[1]))
+                manual = fields[1] > 0;
+            snprintf(res, len, "F:");
+            return true;
+
+        case 'R':
+            // R:motor:position
+            if (count > 2 && !std::isnan(fields[2]))
+                moveTo(static_cast<int32_t>(fields[2]));
+            snprintf(res, len, "R:");
+            return true;
+
+        case 'P':
+            if (count > 1 && !std::isnan(fields[1]))
+                currentPos = targetPos = static_cast<int32_t>(fields[1]);
+            snprintf(res, len, "P:");
+            return true;
+
+        case 'H':
+            targetPos = static_cast<int32_t>(std::round(currentPos));
+            currentPos = targetPos;
+            snprintf(res, len, "H:");
+            return true;
+
+        case 'S':
+        {
+            int32_t diff = compensationDiff();
+            double threshold = (count > 1 && !std::isnan(fields[1])) ? fields[1] : 0;
+            if (diff != 0 && std::abs(diff) >= threshold)
+            {
+                moveTo(targetPos + diff);
+                compReference = temperature();
+            }
+            snprintf(res, len, "S:");
+            return true;
+        }
+    }
+
+    snprintf(res, len, "?");
+    return false;
+}
+
+int32_t FocuserLinkDevice::position()
+{
+    return static_cast<int32_t>(std::round(currentPos));
+}
+
+int32_t FocuserLinkDevice::stepsToGo()
+{
+    return targetPos - position();
+}
+
+double FocuserLinkDevice::temperature()
+{
+    double hours = std::chrono::duration<double>(Clock::now() - started).count() / 3600.0;
+    return config.temperature + config.tempDrift * hours;
+}
+
+double FocuserLinkDevice::dewPoint()
+{
+    // Magnus formula
+    double t = temperature();
+    double gamma = std::log(config.humidity / 100.0) + 17.62 * t / (243.12 + t);
+    return 243.12 * gamma / (17.62 - gamma);
+}
+
+int32_t FocuserLinkDevice::compensationDiff()
+{
+    return static_cast<int32_t>(std::round((temperature() - compReference) * settings[U_COMPSTEP] / 100.0));
+}
+
+void FocuserLinkDevice::update()
+{
+    Clock::time_point now = Clock::now();
+    double dt = std::chrono::duration<double>(now - lastUpdate).count();
+    lastUpdate = now;
+
+    double remaining = targetPos - currentPos;
+    double travel = config.stepRate * dt;
+    if (std::fabs(remaining) <= travel)
+        currentPos = targetPos;
+    else
+        currentPos += (remaining > 0) ? travel : -travel;
+
+    // automatic compensation runs every compensation cycle while motor is idle
+    double elapsed = std::chrono::duration<double>(now - started).count();
+    if (settings[U_COMPAUTO] > 0 && stepsToGo() == 0 && elapsed - lastCompensation >= settings[U_COMPCYCLE])
+    {
+        lastCompensation = elapsed;
+        int32_t diff = compensationDiff();
+        if (diff != 0 && std::abs(diff) >= settings[U_COMPTRIGGER])
+        {
+            moveTo(targetPos + diff);
+            compReference = temperature();
+        }
+    }
+}
+
+void FocuserLinkDevice::moveTo(int32_t target)
+{
+    if (target < 0)
+        target = 0;
+    if (target > static_cast<int32_t>(settings[U_MAX_POS]))
+        target = static_cast<int32_t>(settings[U_MAX_POS]);
+    targetPos = target;
+}
+
+void FocuserLinkDevice::setSettings(const char *cmd)
+{
+    double fields[FOCUSERLINK_MAX_FIELDS];
+    int count = FocuserLinkProtocol::parseFields(cmd, fields, FOCUSERLINK_MAX_FIELDS);
+    for (int i = 1; i < count && i < settingsCount; i++)
+    {
+        if (!std::isnan(fields[i]))
+            settings[i] = fields[i];
+    }
+}
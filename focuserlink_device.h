@@ -0,0 +1,79 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_DEVICE_H
+#define FOCUSERLINK_DEVICE_H
+
+#include <chrono>
+#include <stdint.h>
+
+#include "focuserlink_protocol.h"
+
+struct FocuserLinkDeviceConfig
+{
+    double stepRate = 800;          // [steps/s]
+    int32_t position = 50000;
+    uint32_t maxPos = 100000;
+    double stepSize = 5.0;          // [um]
+    double temperature = 10.0;      // [C]
+    double tempDrift = -0.5;        // [C/h]
+    double humidity = 65.0;         // [%]
+    bool hasSensor = true;
+};
+
+// Software model of the FocuserLink controller. Speaks the same line protocol
+// as the firmware, used by the emulator and by the driver simulation mode.
+class FocuserLinkDevice
+{
+public:
+    explicit FocuserLinkDevice(const FocuserLinkDeviceConfig &config = FocuserLinkDeviceConfig());
+
+    // cmd is a single line without terminator, reply is written to res without
+    // terminator. Returns false for unknown commands, res is set to "?" then.
+    bool handle(const char *cmd, char *res, int len);
+
+    int32_t position();
+    int32_t stepsToGo();
+    double temperature();
+    double dewPoint();
+    int32_t compensationDiff();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void update();
+    void moveTo(int32_t target);
+    void setSettings(const char *cmd);
+
+    FocuserLinkDeviceConfig config;
+    Clock::time_point started;
+    Clock::time_point lastUpdate;
+
+    double currentPos;
+    int32_t targetPos;
+    bool manual = false;
+
+    // settings record, stored as the firmware keeps it
+    double settings[FOCUSERLINK_MAX_FIELDS];
+    int settingsCount;
+
+    double compReference;           // temperature at last compensation
+    double lastCompensation = 0;    // [s since start]
+};
+
+#endif
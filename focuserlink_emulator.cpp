@@ -0,0 +1,357 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_emulator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static double seconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+FocuserLinkEmulator::FocuserLinkEmulator(const FocuserLinkDeviceConfig &config) : config(config), device(config)
+{
+    startTime = busyUntil = Clock::now();
+}
+
+FocuserLinkEmulator::~FocuserLinkEmulator()
+{
+    close();
+}
+
+bool FocuserLinkEmulator::open()
+{
+    if (!createPty())
+        return false;
+    startTime = busyUntil = Clock::now();
+    return true;
+}
+
+void FocuserLinkEmulator::close()
+{
+    closePty();
+}
+
+bool FocuserLinkEmulator::createPty()
+{
+    masterFD = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFD < 0 || grantpt(masterFD) != 0 || unlockpt(masterFD) != 0)
+        return false;
+    std::string name = ptsname(masterFD);
+
+    // keep slave side open and raw, so the pty survives driver reconnects and
+    // replies are not echoed back to us
+    slaveFD = ::open(name.c_str(), O_RDWR | O_NOCTTY);
+    if (slaveFD < 0)
+        return false;
+    struct termios tio;
+    tcgetattr(slaveFD, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slaveFD, TCSANOW, &tio);
+
+    std::lock_guard<std::mutex> guard(slaveLock);
+    slave = name;
+    return true;
+}
+
+void FocuserLinkEmulator::closePty()
+{
+    if (slaveFD >= 0)
+        ::close(slaveFD);
+    if (masterFD >= 0)
+        ::close(masterFD);
+    slaveFD = masterFD = -1;
+}
+
+double FocuserLinkEmulator::uptime() const
+{
+    return seconds(Clock::now() - startTime);
+}
+
+void FocuserLinkEmulator::run(const std::atomic<bool> &stop)
+{
+    while (!stop.load())
+    {
+        if (unplugged)
+        {
+            if (Clock::now() < deadUntil)
+            {
+                poll(nullptr, 0, 10);
+                continue;
+            }
+            if (!createPty())
+            {
+                perror("pty");
+                return;
+            }
+            unplugged = false;
+            if (verbose)
+                fprintf(stderr, "%10.3f plugged in again as %s\n", uptime(), slaveName().c_str());
+        }
+
+        // wake up for input or for the next reply leaving the link
+        int timeoutMs = 100;
+        if (!replies.empty())
+        {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(replies.front().due - Clock::now()).count();
+            timeoutMs = std::max<int>(0, std::min<int>(timeoutMs, wait + 1));
+        }
+
+        struct pollfd pfd = { masterFD, POLLIN, 0 };
+        if (poll(&pfd, 1, timeoutMs) > 0)
+        {
+            char buf[256];
+            ssize_t n = read(masterFD, buf, sizeof(buf));
+            Clock::time_point arrived = Clock::now();
+            for (ssize_t i = 0; i < n; i++)
+            {
+                if (buf[i] == '\r')
+                    continue;
+                if (buf[i] != '\n')
+                {
+                    if (lineLen < ASTROLINK4_LEN - 1)
+                        line[lineLen++] = buf[i];
+                    continue;
+                }
+                line[lineLen] = '\0';
+                lineLen = 0;
+                if (line[0] != '\0')
+                    process(line, arrived);
+            }
+        }
+        sendDue();
+    }
+}
+
+void FocuserLinkEmulator::process(const char *cmd, Clock::time_point arrived)
+{
+    if (replay != nullptr)
+    {
+        processReplay(cmd, arrived);
+        return;
+    }
+
+    if (arrived < deadUntil)
+    {
+        counters.lost++;
+        return;
+    }
+    if (roll(faults.disconnectRate))
+    {
+        counters.disconnects++;
+        deadUntil = arrived + std::chrono::milliseconds(faults.disconnectMs);
+        if (random() % 2)
+        {
+            // reads on the other side of the pty fail with EIO from now on
+            counters.unplugs++;
+            unplugged = true;
+            closePty();
+            replies.clear();
+            lineLen = 0;
+        }
+        if (verbose)
+            fprintf(stderr, "%10.3f line %s for %d ms\n", uptime(), unplugged ? "unplugged" : "dead", faults.disconnectMs);
+        return;
+    }
+
+    // the controller works through commands one at a time
+    busyUntil = std::max(busyUntil, arrived) + std::chrono::milliseconds(latencyMs);
+
+    char res[ASTROLINK4_LEN];
+    device.handle(cmd, res, sizeof(res) - 1);
+    counters.commands[cmd[0] & 0x7F]++;
+
+    if (cmd[0] == 'R')
+    {
+        moving = true;
+        moveEnd = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::duration<double>(std::abs(device.stepsToGo()) / config.stepRate));
+    }
+    else if (cmd[0] == 'q' && moving && device.stepsToGo() == 0)
+    {
+        // time between modelled end of motion and the poll that saw it
+        double overhead = seconds(Clock::now() - moveEnd);
+        if (overhead < 0)
+            overhead = 0;
+        moving = false;
+        counters.moves++;
+        counters.moveOverhead += overhead;
+        if (overhead > counters.maxMoveOverhead)
+            counters.maxMoveOverhead = overhead;
+        if (verbose)
+            fprintf(stderr, "move finished, detected after %.1f ms\n", overhead * 1000.0);
+    }
+
+    if (verbose)
+        fprintf(stderr, "%10.3f %s -> %s\n", uptime(), cmd, res);
+
+    Reply reply;
+    reply.due = busyUntil + std::chrono::milliseconds(linkDelayMs);
+    reply.data = res;
+    reply.data += '\n';
+    if (inject(reply))
+        replies.push_back(reply);
+}
+
+void FocuserLinkEmulator::processReplay(const char *cmd, Clock::time_point arrived)
+{
+    counters.commands[cmd[0] & 0x7F]++;
+    const FocuserLinkExchange *exchange = replay->next(cmd);
+    if (exchange == nullptr)
+    {
+        counters.replayMissing++;
+        if (verbose)
+            fprintf(stderr, "%10.3f %s -> no recorded exchange left\n", uptime(), cmd);
+        return;
+    }
+    counters.replayed++;
+    if (verbose)
+        fprintf(stderr, "%10.3f %s -> %s (recorded %s)\n", uptime(), cmd,
+                exchange->result == FocuserLinkExchange::EXCHANGE_OK ? exchange->reply : "no reply", exchange->command);
+    // recorded timeouts and errors stay unanswered
+    if (exchange->result != FocuserLinkExchange::EXCHANGE_OK)
+        return;
+
+    Reply reply;
+    reply.due = arrived;
+    if (recordedSpeed)
+        reply.due += std::chrono::microseconds(exchange->roundTripUs);
+    // replies leave in command order
+    if (!replies.empty())
+        reply.due = std::max(reply.due, replies.back().due);
+    reply.data = exchange->reply;
+    reply.data += '\n';
+    replies.push_back(reply);
+}
+
+bool FocuserLinkEmulator::roll(double rate)
+{
+    return rate > 0 && std::uniform_real_distribution<double>(0, 1)(random) < rate;
+}
+
+bool FocuserLinkEmulator::inject(Reply &reply)
+{
+    if (roll(faults.dropRate))
+    {
+        counters.dropped++;
+        return false;
+    }
+    if (roll(faults.spikeRate))
+    {
+        counters.spikes++;
+        reply.due += std::chrono::milliseconds(faults.spikeMs);
+        // the device is stuck as well, later replies queue up behind this one
+        busyUntil = std::max(busyUntil, reply.due);
+    }
+    if (roll(faults.corruptRate))
+    {
+        static const char *garbage[] = { "x", "99999999999", "-1e300", "nan", "inf", "", "1:2" };
+        counters.corrupted++;
+        std::string &data = reply.data;
+        size_t fields = std::count(data.begin(), data.end(), ':');
+        if (fields > 0)
+        {
+            // replace the n-th field
+            size_t n = std::uniform_int_distribution<size_t>(1, fields)(random);
+            size_t start = 0;
+            for (size_t i = 0; i < n; i++)
+                start = data.find(':', start) + 1;
+            size_t end = data.find_first_of(":\n", start);
+            data.replace(start, end - start, garbage[std::uniform_int_distribution<int>(0, 6)(random)]);
+        }
+        else
+            data[0] ^= 0x20;
+    }
+    if (roll(faults.shortRate))
+    {
+        counters.truncated++;
+        size_t length = reply.data.size() - 1;
+        // a lone letter is the most common short read
+        size_t keep = (random() % 4 == 0 || length < 2) ? 1 : std::uniform_int_distribution<size_t>(1, length - 1)(random);
+        bool terminated = random() % 2;
+        reply.data.resize(keep);
+        if (terminated)
+            reply.data += '\n';
+    }
+    return true;
+}
+
+bool FocuserLinkFaults::parse(const char *spec)
+{
+    std::string text(spec);
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string item = text.substr(start, end - start);
+        start = end + 1;
+
+        double rate = 0;
+        int ms = 0;
+        char name[16];
+        int n = sscanf(item.c_str(), "%15[a-z]=%lf:%d", name, &rate, &ms);
+        if (n < 2)
+            return false;
+        std::string key(name);
+        if (key == "spike")
+        {
+            spikeRate = rate;
+            if (n == 3)
+                spikeMs = ms;
+        }
+        else if (key == "drop")
+            dropRate = rate;
+        else if (key == "corrupt")
+            corruptRate = rate;
+        else if (key == "short")
+            shortRate = rate;
+        else if (key == "disconnect")
+        {
+            disconnectRate = rate;
+            if (n == 3)
+                disconnectMs = ms;
+        }
+        else if (key == "seed")
+            seed = static_cast<unsigned>(rate);
+        else
+            return false;
+    }
+    return true;
+}
+
+void FocuserLinkEmulator::sendDue()
+{
+    if (masterFD < 0)
+        return;
+    Clock::time_point now = Clock::now();
+    while (!replies.empty() && replies.front().due <= now)
+    {
+        if (write(masterFD, replies.front().data.data(), replies.front().data.size()) < 0)
+            perror("write");
+        replies.pop_front();
+    }
+}
@@ -0,0 +1,158 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_EMULATOR_H
+#define FOCUSERLINK_EMULATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "focuserlink_device.h"
+#include "focuserlink_transcript.h"
+
+struct FocuserLinkEmulatorStats
+{
+    unsigned long commands[128] = {0};
+    unsigned long moves = 0;
+    double moveOverhead = 0;        // sum of detection delay after modelled motion end [s]
+    double maxMoveOverhead = 0;
+    unsigned long replayed = 0;
+    unsigned long replayMissing = 0;    // commands with no recorded exchange left
+    // injected faults
+    unsigned long spikes = 0;
+    unsigned long dropped = 0;
+    unsigned long corrupted = 0;
+    unsigned long truncated = 0;
+    unsigned long disconnects = 0;
+    unsigned long unplugs = 0;          // disconnects that took the pty away
+    unsigned long lost = 0;             // commands sent while disconnected
+};
+
+// Faults injected into the replies, rates are probabilities per command
+struct FocuserLinkFaults
+{
+    double spikeRate = 0;
+    int spikeMs = 3000;         // added to the reply delay
+    double dropRate = 0;
+    double corruptRate = 0;     // one field garbled or out of range
+    double shortRate = 0;       // reply cut short, down to the letter alone, terminator lost half the time
+    double disconnectRate = 0;
+    // line dead, commands are lost and nothing is answered; half the time the
+    // device is unplugged instead, the pty goes away (EIO on the line) and
+    // comes back under a new name
+    int disconnectMs = 5000;
+    unsigned seed = 1;
+
+    // e.g. "spike=0.01:3000,drop=0.001,corrupt=0.001,short=0.001,disconnect=0.0001:5000,seed=7"
+    bool parse(const char *spec);
+};
+
+// FocuserLink controller on a pseudo terminal, backed by the device model.
+// Commands are processed one after another, each taking latencyMs. Replies
+// leave the emulator linkDelayMs after processing, modelling the USB serial
+// round trip. Commands written back to back overlap in the link delay.
+class FocuserLinkEmulator
+{
+public:
+    explicit FocuserLinkEmulator(const FocuserLinkDeviceConfig &config = FocuserLinkDeviceConfig());
+    ~FocuserLinkEmulator();
+
+    // creates the pty, returns false with errno set on failure
+    bool open();
+    void close();
+    // changes when an unplugged device comes back
+    std::string slaveName() const
+    {
+        std::lock_guard<std::mutex> guard(slaveLock);
+        return slave;
+    }
+
+    // answers from a transcript instead of the device model, with the recorded
+    // round trip times or as fast as possible
+    void setReplay(FocuserLinkReplay *replay, bool recordedSpeed)
+    {
+        this->replay = replay;
+        this->recordedSpeed = recordedSpeed;
+    }
+
+    void setFaults(const FocuserLinkFaults &faults)
+    {
+        this->faults = faults;
+        random.seed(faults.seed);
+    }
+
+    // serves commands until stop becomes true
+    void run(const std::atomic<bool> &stop);
+
+    int latencyMs = 0;
+    int linkDelayMs = 0;
+    bool verbose = false;
+
+    const FocuserLinkEmulatorStats &stats() const
+    {
+        return counters;
+    }
+    double uptime() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Reply
+    {
+        Clock::time_point due;
+        std::string data;
+    };
+
+    bool createPty();
+    void closePty();
+    void process(const char *line, Clock::time_point arrived);
+    void processReplay(const char *line, Clock::time_point arrived);
+    void sendDue();
+    bool roll(double rate);
+    bool inject(Reply &reply);
+
+    FocuserLinkDeviceConfig config;
+    FocuserLinkDevice device;
+    FocuserLinkEmulatorStats counters;
+    int masterFD = -1;
+    int slaveFD = -1;
+    std::string slave;
+    mutable std::mutex slaveLock;
+    bool unplugged = false;
+
+    Clock::time_point startTime;
+    Clock::time_point busyUntil;
+    Clock::time_point moveEnd;
+    bool moving = false;
+    std::deque<Reply> replies;
+    FocuserLinkReplay *replay = nullptr;
+    bool recordedSpeed = true;
+
+    FocuserLinkFaults faults;
+    std::mt19937 random;
+    Clock::time_point deadUntil;
+
+    char line[ASTROLINK4_LEN];
+    int lineLen = 0;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// FocuserLink controller emulator on a pseudo terminal. Start it, then point
+// the driver port to the printed /dev/pts/N (or the -L link):
+//   focuserlink_emulator [-r steps/s] [-l latency ms] [-k link delay ms] [-d drift C/h]
+//                        [-t temp C] [-p position] [-m max position] [-L link] [-v]
+//                        [-R transcript [-F]] [-f faults]
+// With -R the replies come from a transcript recorded by the driver, at the
+// recorded round trip times or, with -F, at once. -f injects faults into the
+// replies, e.g. -f spike=0.01:3000,drop=0.001,corrupt=0.001,short=0.001,disconnect=0.0001:5000,seed=7
+// Statistics are printed on SIGINT/SIGTERM.
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "focuserlink_emulator.h"
+
+static std::atomic<bool> terminated { false };
+
+static void onSignal(int)
+{
+    terminated = true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-r steps/s] [-l latency ms] [-k link delay ms] [-d drift C/h] [-t temp C] [-p position] "
+            "[-m max position] [-L link] [-v] [-R transcript [-F]] [-f faults]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    FocuserLinkDeviceConfig config;
+    int latencyMs = 0, linkDelayMs = 0;
+    const char *link = nullptr;
+    const char *transcript = nullptr;
+    bool verbose = false;
+    bool fast = false;
+    FocuserLinkFaults faults;
+    bool faulty = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:l:k:d:t:p:m:L:R:Ff:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                config.stepRate = atof(optarg);
+                break;
+            case 'l':
+                latencyMs = atoi(optarg);
+                break;
+            case 'k':
+                linkDelayMs = atoi(optarg);
+                break;
+            case 'd':
+                config.tempDrift = atof(optarg);
+                break;
+            case 't':
+                config.temperature = atof(optarg);
+                break;
+            case 'p':
+                config.position = atoi(optarg);
+                break;
+            case 'm':
+                config.maxPos = atoi(optarg);
+                break;
+            case 'L':
+                link = optarg;
+                break;
+            case 'R':
+                transcript = optarg;
+                break;
+            case 'F':
+                fast = true;
+                break;
+            case 'f':
+                if (!faults.parse(optarg))
+                {
+                    fprintf(stderr, "%s: bad fault specification\n", optarg);
+                    return 1;
+                }
+                faulty = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    FocuserLinkEmulator emulator(config);
+    emulator.latencyMs = latencyMs;
+    emulator.linkDelayMs = linkDelayMs;
+    emulator.verbose = verbose;
+    if (faulty)
+        emulator.setFaults(faults);
+
+    FocuserLinkReplay replay;
+    if (transcript != nullptr)
+    {
+        if (!replay.load(transcript))
+        {
+            fprintf(stderr, "%s: not a FocuserLink transcript\n", transcript);
+            return 1;
+        }
+        fprintf(stderr, "replaying %zu exchanges\n", replay.size());
+        emulator.setReplay(&replay, !fast);
+    }
+    if (!emulator.open())
+    {
+        perror("pty");
+        return 1;
+    }
+
+    if (link != nullptr)
+    {
+        unlink(link);
+        if (symlink(emulator.slaveName().c_str(), link) != 0)
+        {
+            perror(link);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    printf("%s\n", emulator.slaveName().c_str());
+    fflush(stdout);
+
+    emulator.run(terminated);
+
+    const FocuserLinkEmulatorStats &stats = emulator.stats();
+    double elapsed = emulator.uptime();
+    fprintf(stderr, "uptime %.1f s\n", elapsed);
+    for (int c = 0; c < 128; c++)
+    {
+        if (stats.commands[c] > 0)
+            fprintf(stderr, "  %c %8lu  %8.2f/s\n", c, stats.commands[c], stats.commands[c] / elapsed);
+    }
+    if (stats.moves > 0)
+        fprintf(stderr, "moves %lu, completion detected after avg %.1f ms, max %.1f ms\n", stats.moves,
+                stats.moveOverhead * 1000.0 / stats.moves, stats.maxMoveOverhead * 1000.0);
+
+    if (transcript != nullptr)
+        fprintf(stderr, "replayed %lu exchanges, %lu commands without a recorded exchange\n", stats.replayed,
+                stats.replayMissing);
+
+    if (faulty)
+        fprintf(stderr, "faults: %lu spikes, %lu dropped, %lu corrupted, %lu truncated, %lu disconnects "
+                "(%lu unplugged, %lu commands lost)\n", stats.spikes, stats.dropped, stats.corrupted,
+                stats.truncated, stats.disconnects, stats.unplugs, stats.lost);
+
+    if (link != nullptr)
+        unlink(link);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+void FocuserLinkEstimator::sample(Clock::time_point time, int32_t position, int32_t stepsToGo, int32_t plannedSteps,
+                                  double rate)
+{
+    // only samples taken while the estimate was running say something about it
+    if (hasSample && this->stepsToGo != 0)
+    {
+        drift = position - this->position(time);
+        absDriftEma += 0.1 * (std::fabs(drift) - absDriftEma);
+        maxAbsDrift = std::max(maxAbsDrift, std::fabs(drift));
+    }
+
+    hasSample = true;
+    this->time = time;
+    lastPosition = position;
+    this->stepsToGo = stepsToGo;
+    this->plannedSteps = plannedSteps;
+    this->rate = rate;
+}
+
+void FocuserLinkEstimator::reset()
+{
+    hasSample = false;
+    stepsToGo = plannedSteps = 0;
+}
+
+void FocuserLinkEstimator::resetDrift()
+{
+    drift = absDriftEma = maxAbsDrift = 0;
+}
+
+double FocuserLinkEstimator::travelled(Clock::time_point now) const
+{
+    double elapsed = std::max(std::chrono::duration<double>(now - time).count(), 0.0);
+    return std::min(elapsed * rate, static_cast<double>(std::abs(stepsToGo)));
+}
+
+double FocuserLinkEstimator::position(Clock::time_point now) const
+{
+    double steps = travelled(now);
+    return lastPosition + (stepsToGo < 0 ? -steps : steps);
+}
+
+double FocuserLinkEstimator::eta(Clock::time_point now) const
+{
+    if (rate <= 0)
+        return 0;
+    return (std::abs(stepsToGo) + plannedSteps - travelled(now)) / rate;
+}
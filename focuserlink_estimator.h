@@ -0,0 +1,76 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_ESTIMATOR_H
+#define FOCUSERLINK_ESTIMATOR_H
+
+#include <chrono>
+#include <stdint.h>
+
+// Position between hardware polls, extrapolated from the last q sample at the
+// learned step rate and stopped at the end of the current leg. Each new sample
+// replaces the estimate, the difference to what was predicted for that moment
+// is kept as drift.
+class FocuserLinkEstimator
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    void sample(Clock::time_point time, int32_t position, int32_t stepsToGo, int32_t plannedSteps, double rate);
+    void reset();
+
+    // motor is expected to run after the last sample
+    bool moving() const
+    {
+        return stepsToGo != 0 || plannedSteps != 0;
+    }
+    double position(Clock::time_point now) const;
+    double eta(Clock::time_point now) const;
+
+    // [steps], hardware minus estimate
+    double lastDrift() const
+    {
+        return drift;
+    }
+    // moving average of the abs drift, exponential with weight 0.1 per sample
+    double driftEma() const
+    {
+        return absDriftEma;
+    }
+    double maxDrift() const
+    {
+        return maxAbsDrift;
+    }
+    void resetDrift();
+
+private:
+    double travelled(Clock::time_point now) const;
+
+    bool hasSample = false;
+    Clock::time_point time;
+    int32_t lastPosition = 0;
+    int32_t stepsToGo = 0;
+    int32_t plannedSteps = 0;
+    double rate = 0;
+
+    double drift = 0;
+    double absDriftEma = 0;
+    double maxAbsDrift = 0;
+};
+
+#endif
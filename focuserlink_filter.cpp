@@ -0,0 +1,83 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_filter.h"
+
+#include <algorithm>
+
+void FocuserLinkFilter::configure(double alpha, int window)
+{
+    this->alpha = std::max(0.0, std::min(alpha, 1.0));
+    this->window = std::max(1, std::min(window, FILTER_MAX_WINDOW));
+    reset();
+}
+
+void FocuserLinkFilter::reset()
+{
+    next = 0;
+    count = 0;
+    average = 0;
+}
+
+void FocuserLinkFilter::add(double seconds, double value)
+{
+    average = (count == 0) ? value : average + alpha * (value - average);
+
+    // the oldest sample leaves the sorted window, then the new one is inserted in place
+    int size = count;
+    if (count == window)
+    {
+        double *leaving = std::lower_bound(sorted, sorted + size, values[next]);
+        std::copy(leaving + 1, sorted + size, leaving);
+        size--;
+    }
+    else
+        count++;
+    double *position = std::upper_bound(sorted, sorted + size, value);
+    std::copy_backward(position, sorted + size, sorted + size + 1);
+    *position = value;
+
+    values[next] = value;
+    times[next] = seconds;
+    next = (next + 1) % window;
+}
+
+double FocuserLinkFilter::median() const
+{
+    if (count % 2)
+        return sorted[count / 2];
+    return (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+}
+
+double FocuserLinkFilter::rate() const
+{
+    double span = times[newest()] - times[oldest()];
+    return (count > 1 && span > 0) ? (values[newest()] - values[oldest()]) * 3600.0 / span : 0;
+}
+
+double FocuserLinkFilter::value(Mode mode) const
+{
+    switch (mode)
+    {
+        case FILTER_EMA:
+            return ema();
+        case FILTER_MEDIAN:
+            return median();
+        default:
+            return raw();
+    }
+}
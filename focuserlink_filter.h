@@ -0,0 +1,91 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_FILTER_H
+#define FOCUSERLINK_FILTER_H
+
+// longest window of the median, min/max and rate filters [samples]
+#define FILTER_MAX_WINDOW   64
+
+// Streaming filters of one sensor channel: exponential moving average,
+// median, minimum, maximum and rate of change over the last window samples.
+// The window is kept in arrival order and sorted, the sorted copy gives
+// median, minimum and maximum directly. Cost per sample is bounded by
+// FILTER_MAX_WINDOW, nothing is allocated.
+class FocuserLinkFilter
+{
+public:
+    enum Mode
+    {
+        FILTER_RAW, FILTER_EMA, FILTER_MEDIAN
+    };
+
+    // alpha weights the newest sample of the average, resets the filter
+    void configure(double alpha, int window);
+    void reset();
+
+    // seconds on any monotonic clock
+    void add(double seconds, double value);
+
+    bool valid() const
+    {
+        return count > 0;
+    }
+    double raw() const
+    {
+        return values[newest()];
+    }
+    double ema() const
+    {
+        return average;
+    }
+    double median() const;
+    double min() const
+    {
+        return sorted[0];
+    }
+    double max() const
+    {
+        return sorted[count - 1];
+    }
+    // [1/h] between the oldest and newest sample of the window
+    double rate() const;
+
+    double value(Mode mode) const;
+
+private:
+    int newest() const
+    {
+        return (next + window - 1) % window;
+    }
+    int oldest() const
+    {
+        return (next + window - count) % window;
+    }
+
+    double alpha = 0.3;
+    int window = 9;
+    double average = 0;
+    double values[FILTER_MAX_WINDOW];
+    double times[FILTER_MAX_WINDOW];
+    double sorted[FILTER_MAX_WINDOW];
+    int next = 0;
+    int count = 0;
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_framer.h"
+
+#include <cstring>
+
+void FocuserLinkFramer::reset()
+{
+    used = 0;
+    skipping = false;
+}
+
+void FocuserLinkFramer::feed(const char *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        char c = data[i];
+        if (skipping)
+        {
+            if (c == '\n')
+                skipping = false;
+            continue;
+        }
+
+        if (used == FRAMER_BUFFER_SIZE)
+        {
+            // incomplete line does not fit, drop it and wait for the next line end
+            int lineStart = used;
+            while (lineStart > 0 && buffer[lineStart - 1] != '\n')
+                lineStart--;
+            used = lineStart;
+            dropped++;
+            skipping = (c != '\n');
+            continue;
+        }
+        buffer[used++] = c;
+    }
+}
+
+bool FocuserLinkFramer::nextFrame(char *frame, int len)
+{
+    char *end = static_cast<char *>(memchr(buffer, '\n', used));
+    if (end == nullptr)
+        return false;
+
+    int lineLen = end - buffer;
+    int frameLen = lineLen;
+    while (frameLen > 0 && (buffer[frameLen - 1] == '\r' || buffer[frameLen - 1] == '\0'))
+        frameLen--;
+    if (frameLen > len - 1)
+    {
+        frameLen = len - 1;
+        dropped++;
+    }
+    memcpy(frame, buffer, frameLen);
+    frame[frameLen] = '\0';
+
+    used -= lineLen + 1;
+    memmove(buffer, end + 1, used);
+    return true;
+}
+
+bool FocuserLinkFramer::nextReply(char expected, char *frame, int len)
+{
+    const char letters[2] = { expected, '\0' };
+    return nextReply(letters, frame, len) == 0;
+}
+
+int FocuserLinkFramer::nextReply(const char *expected, char *frame, int len)
+{
+    while (nextFrame(frame, len))
+    {
+        // reply is the command letter, optionally followed by fields
+        if (frame[0] != '\0' && (frame[1] == ':' || frame[1] == '\0'))
+        {
+            const char *match = strchr(expected, frame[0]);
+            if (match != nullptr)
+                return match - expected;
+        }
+        // empty lines are line noise, anything else is a late or unsolicited reply
+        if (frame[0] != '\0')
+            dropped++;
+    }
+    return -1;
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_FRAMER_H
+#define FOCUSERLINK_FRAMER_H
+
+#include "focuserlink_protocol.h"
+
+#define FRAMER_BUFFER_SIZE  (4 * ASTROLINK4_LEN)
+
+// Persistent receive buffer splitting the serial byte stream into newline
+// terminated frames. Bytes are kept between commands, so late replies are not
+// lost and nothing has to be flushed. Overlong lines and lines not matching
+// the expected reply are dropped, the framer resynchronises on the next line end.
+class FocuserLinkFramer
+{
+public:
+    void reset();
+
+    // append received bytes
+    void feed(const char *data, int len);
+
+    // next complete line without terminator, false if there is none yet
+    bool nextFrame(char *frame, int len);
+
+    // next line that is a reply to command letter expected, lines before it are dropped
+    bool nextReply(char expected, char *frame, int len);
+
+    // same for several outstanding commands, returns position of the matching
+    // letter in expected or -1 when no reply is complete yet
+    int nextReply(const char *expected, char *frame, int len);
+
+    bool empty() const
+    {
+        return used == 0;
+    }
+
+    unsigned long discarded() const
+    {
+        return dropped;
+    }
+
+private:
+    char buffer[FRAMER_BUFFER_SIZE];
+    int used = 0;
+    bool skipping = false;
+    unsigned long dropped = 0;
+};
+
+#endif
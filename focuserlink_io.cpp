@@ -0,0 +1,657 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_io.h"
+#include "focuserlink_reactor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+FocuserLinkIO::FocuserLinkIO(Exchange exchange) : exchange(exchange)
+{
+}
+
+FocuserLinkIO::~FocuserLinkIO()
+{
+    stop();
+}
+
+bool FocuserLinkIO::start()
+{
+    if (running.load())
+        return true;
+
+    if (pipe(notifyPipe) != 0)
+        return false;
+    fcntl(notifyPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(notifyPipe[1], F_SETFL, O_NONBLOCK);
+
+    FocuserLinkJob job;
+    while (jobs.pop(job))
+        ;
+    events.clear();
+    overflowCount = 0;
+    linkLostPending = false;
+    settingsStale = manualStale = true;
+    settingsValid = false;
+    pendingCount = 0;
+    moving = false;
+    motion.cancel();
+    moveTicket = 0;
+    legAcked = legDue = false;
+    entryCount = 0;
+    motionExpected = false;
+    nextPosition = nextEnvironment = nextSettings = Clock::now();
+
+    if (port != nullptr)
+        port->finish();
+
+    running = true;
+    if (!FocuserLinkReactor::instance().add(this))
+    {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void FocuserLinkIO::stop()
+{
+    // once removed the reactor no longer touches this session
+    if (running.exchange(false))
+        FocuserLinkReactor::instance().remove(this);
+    if (port != nullptr)
+        port->finish();
+    completions.clear();
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (notifyPipe[i] >= 0)
+            close(notifyPipe[i]);
+        notifyPipe[i] = -1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+/// INDI thread side
+//////////////////////////////////////////////////////////////////////
+bool FocuserLinkIO::submit(const FocuserLinkJob &job)
+{
+    if (!running.load() || !jobs.push(job))
+        return false;
+    wakeUp();
+    return true;
+}
+
+bool FocuserLinkIO::submitCommand(const char *cmd, Completion done)
+{
+    FocuserLinkJob job;
+    job.type = FocuserLinkJob::JOB_COMMAND;
+    snprintf(job.command, ASTROLINK4_LEN, "%s", cmd);
+    job.ticket = addCompletion(done);
+
+    if (submit(job))
+        return true;
+    completions.erase(job.ticket);
+    return false;
+}
+
+bool FocuserLinkIO::submitMove(const FocuserLinkMotionPlan &plan, Completion done)
+{
+    FocuserLinkJob job;
+    job.type = FocuserLinkJob::JOB_MOVE;
+    job.command[0] = '\0';
+    job.ticket = addCompletion(done);
+    job.plan = plan;
+
+    if (submit(job))
+        return true;
+    completions.erase(job.ticket);
+    return false;
+}
+
+uint32_t FocuserLinkIO::addCompletion(Completion done)
+{
+    if (!done)
+        return 0;
+    if (++lastTicket == 0)
+        ++lastTicket;
+    completions[lastTicket] = done;
+    return lastTicket;
+}
+
+bool FocuserLinkIO::submitSettings(const FocuserLinkSchema::SettingsPatch &patch)
+{
+    FocuserLinkJob job;
+    job.type = FocuserLinkJob::JOB_SETTINGS;
+    job.command[0] = '\0';
+    job.ticket = 0;
+    job.settings = patch;
+    return submit(job);
+}
+
+bool FocuserLinkIO::nextEvent(FocuserLinkEvent &event)
+{
+    if (events.pop(event))
+        return true;
+    if (!linkLostPending.exchange(false))
+        return false;
+    event = FocuserLinkEvent();
+    event.type = FocuserLinkEvent::EVENT_LINK_LOST;
+    return true;
+}
+
+void FocuserLinkIO::complete(const FocuserLinkEvent &event)
+{
+    auto it = completions.find(event.ticket);
+    if (it == completions.end())
+        return;
+    Completion done = it->second;
+    completions.erase(it);
+    done(event.ok, event.ok ? event.reply : "");
+}
+
+void FocuserLinkIO::clearNotify()
+{
+    char buf[64];
+    while (read(notifyPipe[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+void FocuserLinkIO::setPolling(uint32_t movingMs, uint32_t idleMs, uint32_t environmentMs, uint32_t settingsMs)
+{
+    movingInterval = movingMs;
+    idleInterval = idleMs;
+    environmentInterval = environmentMs;
+    settingsInterval = settingsMs;
+    rescheduled = true;
+    wakeUp();
+}
+
+void FocuserLinkIO::expectMotion()
+{
+    motionExpected = true;
+    wakeUp();
+}
+
+void FocuserLinkIO::reportLinkLost()
+{
+    FocuserLinkEvent event = FocuserLinkEvent();
+    event.type = FocuserLinkEvent::EVENT_LINK_LOST;
+    publish(event);
+}
+
+void FocuserLinkIO::reportSerial(char command, int code, int arg)
+{
+    FocuserLinkEvent event = FocuserLinkEvent();
+    event.type = FocuserLinkEvent::EVENT_SERIAL;
+    event.command = command;
+    event.code = code;
+    event.arg = arg;
+    publish(event);
+}
+
+void FocuserLinkIO::wakeUp()
+{
+    FocuserLinkReactor::instance().wake();
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Reactor thread
+//////////////////////////////////////////////////////////////////////
+FocuserLinkIO::Clock::time_point FocuserLinkIO::service(Clock::time_point now, bool readable)
+{
+    if (!running.load())
+        return now + std::chrono::seconds(1);
+    flushOverflow();
+
+    // batch in flight, collect replies as they come
+    if (port != nullptr && port->busy())
+    {
+        if (!port->update(readable))
+            return port->deadline();
+        finishBatch();
+        now = Clock::now();
+    }
+
+    prepare(now);
+    if (entryCount > 0)
+    {
+        if (port != nullptr)
+        {
+            const char *cmds[IO_MAX_BATCH];
+            int timeouts[IO_MAX_BATCH];
+            for (int i = 0; i < entryCount; i++)
+            {
+                cmds[i] = entries[i].command;
+                timeouts[i] = FocuserLinkProtocol::replyTimeout(entries[i].command[0]);
+            }
+            port->begin(cmds, entryCount, timeouts);
+            if (!port->update(false))
+                return port->deadline();
+            finishBatch();
+        }
+        else
+        {
+            char res[ASTROLINK4_LEN];
+            for (int i = 0; i < entryCount; i++)
+            {
+                res[0] = '\0';
+                bool ok = exchange(entries[i].command, res);
+                dispatch(entries[i], ok, res, Clock::now());
+            }
+            entryCount = 0;
+        }
+    }
+    return nextDue(Clock::now());
+}
+
+int FocuserLinkIO::pollFD() const
+{
+    return (port != nullptr && port->busy()) ? port->fd() : -1;
+}
+
+void FocuserLinkIO::prepare(Clock::time_point now)
+{
+    entryCount = 0;
+
+    // a job takes up to two slots, a settings write before it and itself
+    FocuserLinkJob job;
+    while (overflowCount == 0 && entryCount + 2 + IO_RESERVED <= IO_MAX_BATCH && jobs.pop(job))
+    {
+        if (job.type == FocuserLinkJob::JOB_SETTINGS)
+        {
+            queueSettings(job);
+            continue;
+        }
+        // keep order of settings changes and commands
+        if (pendingCount > 0)
+            flushSettings();
+        if (job.type == FocuserLinkJob::JOB_MOVE)
+        {
+            startMove(job);
+            continue;
+        }
+        // any other motion command ends the planned move, before a leg due
+        // from the last poll can be queued behind it
+        char letter = job.command[0];
+        if ((letter == 'R' || letter == 'P' || letter == 'H') && motion.active())
+        {
+            motion.cancel();
+            legAcked = legDue = false;
+            finishMove(true);
+        }
+        add(Entry::ENTRY_COMMAND, job.command, job.ticket);
+    }
+
+    if (pendingCount > 0 && now >= flushAt)
+        flushSettings();
+    if (rescheduled.exchange(false))
+        nextPosition = nextEnvironment = nextSettings = now;
+    if (motionExpected.exchange(false))
+    {
+        moving = true;
+        nextPosition = std::min(nextPosition, now + std::chrono::milliseconds(movingInterval.load()));
+    }
+    if (legDue)
+        addLeg();
+
+    poll(now);
+}
+
+void FocuserLinkIO::finishBatch()
+{
+    const char *cmds[IO_MAX_BATCH];
+    Clock::time_point now = Clock::now();
+    for (int i = 0; i < entryCount; i++)
+    {
+        cmds[i] = entries[i].command;
+        bool ok = port->result(i) == FocuserLinkPort::PORT_OK;
+        dispatch(entries[i], ok, ok ? port->reply(i) : "", now);
+    }
+    port->finish();
+    if (report)
+        report(*port, cmds, entryCount);
+    entryCount = 0;
+}
+
+FocuserLinkIO::Clock::time_point FocuserLinkIO::nextDue(Clock::time_point now) const
+{
+    if (motionExpected.load() || rescheduled.load() || legDue)
+        return now;
+    if (!jobs.empty() && overflowCount == 0)
+        return now;
+    Clock::time_point due = std::min(nextPosition, std::min(nextEnvironment, nextSettings));
+    if (pendingCount > 0)
+        due = std::min(due, flushAt);
+    // jobs wait until the INDI thread took the held back events
+    if (!jobs.empty())
+        due = std::min(due, now + std::chrono::milliseconds(IO_OVERFLOW_RETRY));
+    return due;
+}
+
+void FocuserLinkIO::add(Entry::Kind kind, const char *command, uint32_t ticket)
+{
+    Entry &entry = entries[entryCount++];
+    entry.kind = kind;
+    entry.ticket = ticket;
+    snprintf(entry.command, ASTROLINK4_LEN, "%s", command);
+}
+
+void FocuserLinkIO::startMove(const FocuserLinkJob &job)
+{
+    // a new move replaces the plan in progress
+    finishMove(true);
+    motion.begin(job.plan);
+    moveTicket = job.ticket;
+    addLeg();
+}
+
+void FocuserLinkIO::addLeg()
+{
+    char cmd[ASTROLINK4_LEN];
+    FocuserLinkProtocol::formatMove(motion.target(), cmd, ASTROLINK4_LEN);
+    add(Entry::ENTRY_MOVE, cmd);
+    legAcked = legDue = false;
+}
+
+void FocuserLinkIO::finishMove(bool ok)
+{
+    if (moveTicket == 0)
+        return;
+    FocuserLinkEvent event = FocuserLinkEvent();
+    event.type = FocuserLinkEvent::EVENT_DONE;
+    event.command = 'R';
+    event.ticket = moveTicket;
+    event.ok = ok;
+    publish(event);
+    moveTicket = 0;
+}
+
+void FocuserLinkIO::queueSettings(const FocuserLinkJob &job)
+{
+    if (pendingCount == 0)
+        flushAt = Clock::now() + std::chrono::milliseconds(SETTINGS_COALESCE);
+
+    const FocuserLinkSchema::SettingsPatch &patch = job.settings;
+    for (int i = 0; i < patch.count; i++)
+    {
+        int slot = 0;
+        while (slot < pendingCount && pendingIndex[slot] != patch.index[i])
+            slot++;
+        if (slot == FOCUSERLINK_MAX_FIELDS)
+            continue;
+        if (slot == pendingCount)
+            pendingIndex[pendingCount++] = patch.index[i];
+        // later change of the same field wins
+        memcpy(pendingValue[slot], patch.value[i], SCHEMA_VALUE_LEN);
+    }
+}
+
+void FocuserLinkIO::flushSettings()
+{
+    // image is normally filled by the settings poll. If it is missing the u
+    // read goes out first and the write follows once the image is there.
+    if (!settingsValid)
+    {
+        settingsStale = true;
+        return;
+    }
+
+    char cmd[ASTROLINK4_LEN] = {0};
+    const char *values[FOCUSERLINK_MAX_FIELDS];
+    for (int i = 0; i < pendingCount; i++)
+        values[i] = pendingValue[i];
+    int count = pendingCount;
+    pendingCount = 0;
+
+    if (!FocuserLinkProtocol::formatPatched(settingsImage, 'U', pendingIndex, values, count, cmd, ASTROLINK4_LEN))
+    {
+        settingsValid = false;
+        settingsStale = true;
+        failed('U');
+        return;
+    }
+    add(Entry::ENTRY_SETTINGS, cmd);
+}
+
+void FocuserLinkIO::poll(Clock::time_point now)
+{
+    environmentDue = now >= nextEnvironment;
+    if (now >= nextPosition || environmentDue)
+        add(Entry::ENTRY_Q, "q");
+
+    if (now >= nextSettings)
+    {
+        settingsStale = manualStale = true;
+        nextSettings = now + std::chrono::milliseconds(settingsInterval.load());
+    }
+    // a settings write in this batch publishes the new record itself
+    bool writing = false;
+    for (int i = 0; i < entryCount; i++)
+        writing = writing || entries[i].kind == Entry::ENTRY_SETTINGS;
+    if (settingsStale && !writing)
+        add(Entry::ENTRY_U, "u");
+    if (manualStale)
+        add(Entry::ENTRY_F, "f");
+}
+
+void FocuserLinkIO::dispatch(const Entry &entry, bool ok, const char *res, Clock::time_point now)
+{
+    FocuserLinkEvent event;
+    event.command = entry.command[0];
+    event.ticket = entry.ticket;
+    event.ok = ok;
+    event.reply[0] = '\0';
+    event.plannedSteps = 0;
+    event.eta = 0;
+    event.rate = motion.rate();
+    event.time = now;
+
+    switch (entry.kind)
+    {
+        case Entry::ENTRY_COMMAND:
+        {
+            char letter = entry.command[0];
+            if (letter == 'F')
+                manualStale = true;
+            if (ok && (letter == 'R' || letter == 'P' || letter == 'H' || letter == 'S'))
+                motionExpected = true;
+
+            if (entry.ticket != 0)
+            {
+                event.type = FocuserLinkEvent::EVENT_DONE;
+                snprintf(event.reply, ASTROLINK4_LEN, "%s", res);
+                publish(event);
+            }
+            else if (!ok)
+                failed(letter);
+            break;
+        }
+
+        case Entry::ENTRY_SETTINGS:
+            if (!ok)
+            {
+                // device state unknown, read it again
+                settingsValid = false;
+                settingsStale = true;
+                failed('U');
+                break;
+            }
+            // written record becomes the new image: "U:a:b:...:" -> "u:a:b:..."
+            snprintf(settingsImage, ASTROLINK4_LEN, "u%s", entry.command + 1);
+            {
+                size_t len = strlen(settingsImage);
+                if (len > 0 && settingsImage[len - 1] == ':')
+                    settingsImage[len - 1] = '\0';
+            }
+            event.type = FocuserLinkEvent::EVENT_U;
+            event.command = 'u';
+            snprintf(event.reply, ASTROLINK4_LEN, "%s", settingsImage);
+            if (FocuserLinkProtocol::parseU(settingsImage, event.u))
+                publish(event);
+            break;
+
+        case Entry::ENTRY_MOVE:
+            if (!ok)
+            {
+                motion.cancel();
+                finishMove(false);
+                break;
+            }
+            legAcked = true;
+            motionExpected = true;
+            if (motion.plannedSteps() == 0)
+                finishMove(true);
+            break;
+
+        case Entry::ENTRY_Q:
+        {
+            event.type = FocuserLinkEvent::EVENT_Q;
+            uint32_t interval = idleInterval.load();
+            if (ok && FocuserLinkProtocol::parseQ(res, event.q))
+            {
+                const FocuserLinkProtocol::QRecord &q = event.q;
+                if (motion.active())
+                {
+                    motion.sample(q.stepperPos, q.stepsToGo, now);
+                    // leg done, start the next one right away instead of waiting for the INDI thread
+                    if (legAcked && q.stepsToGo == 0)
+                    {
+                        legAcked = false;
+                        legDue = motion.advance();
+                        if (legDue)
+                            motionExpected = true;
+                    }
+                }
+                if (motion.active())
+                {
+                    event.plannedSteps = motion.plannedSteps();
+                    if (!legAcked)
+                        event.plannedSteps += std::abs(static_cast<int32_t>(motion.target()) - q.stepperPos);
+                }
+                event.eta = (std::abs(q.stepsToGo) + event.plannedSteps) / motion.rate();
+
+                moving = (q.stepsToGo != 0 || motion.active());
+                if (moving)
+                {
+                    interval = movingInterval.load();
+                    // poll right when the leg should end if that is before the next regular poll
+                    uint32_t legEnd = motion.legEta(q.stepsToGo) * 1000 + MOTION_ETA_MARGIN;
+                    if (legAcked && q.stepsToGo != 0 && legEnd < interval)
+                        interval = legEnd;
+                }
+                // environment is only passed on at its own cadence
+                event.q.hasEnvironment = event.q.hasEnvironment && environmentDue;
+                if (environmentDue)
+                    nextEnvironment = now + std::chrono::milliseconds(environmentInterval.load());
+                publish(event);
+            }
+            else if (moving)
+                interval = movingInterval.load();
+            nextPosition = now + std::chrono::milliseconds(interval);
+            if (nextEnvironment <= now)
+                nextEnvironment = nextPosition;
+            break;
+        }
+
+        case Entry::ENTRY_U:
+            event.type = FocuserLinkEvent::EVENT_U;
+            if (ok && FocuserLinkProtocol::parseU(res, event.u))
+            {
+                snprintf(settingsImage, ASTROLINK4_LEN, "%s", res);
+                snprintf(event.reply, ASTROLINK4_LEN, "%s", res);
+                settingsValid = true;
+                settingsStale = false;
+                publish(event);
+            }
+            else if (pendingCount > 0 && !settingsValid)
+            {
+                // settings waiting for the image cannot be written
+                pendingCount = 0;
+                failed('U');
+            }
+            break;
+
+        case Entry::ENTRY_F:
+            event.type = FocuserLinkEvent::EVENT_F;
+            if (ok && FocuserLinkProtocol::parseF(res, event.f))
+            {
+                manualStale = false;
+                snprintf(event.reply, ASTROLINK4_LEN, "%s", res);
+                publish(event);
+            }
+            break;
+    }
+}
+
+void FocuserLinkIO::publish(const FocuserLinkEvent &event)
+{
+    flushOverflow();
+    if (overflowCount == 0 && events.push(event))
+    {
+        notify();
+        return;
+    }
+
+    // a full queue means the INDI thread is behind, next poll brings fresh data,
+    // but completions, failures and link loss must arrive and keep their order
+    bool terminal = event.type == FocuserLinkEvent::EVENT_DONE || event.type == FocuserLinkEvent::EVENT_FAILED
+                    || event.type == FocuserLinkEvent::EVENT_LINK_LOST;
+    if (terminal && overflowCount < IO_EVENT_OVERFLOW)
+        overflow[overflowCount++] = event;
+    else if (event.type == FocuserLinkEvent::EVENT_LINK_LOST)
+    {
+        linkLostPending = true;
+        notify();
+    }
+    else
+        dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FocuserLinkIO::flushOverflow()
+{
+    int sent = 0;
+    while (sent < overflowCount && events.push(overflow[sent]))
+        sent++;
+    if (sent == 0)
+        return;
+    std::copy(overflow + sent, overflow + overflowCount, overflow);
+    overflowCount -= sent;
+    notify();
+}
+
+void FocuserLinkIO::notify()
+{
+    char c = 1;
+    if (write(notifyPipe[1], &c, 1) < 0)
+    {
+        // pipe full, reader is already signalled
+    }
+}
+
+void FocuserLinkIO::failed(char command)
+{
+    FocuserLinkEvent event = FocuserLinkEvent();
+    event.type = FocuserLinkEvent::EVENT_FAILED;
+    event.command = command;
+    publish(event);
+}
@@ -0,0 +1,254 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_IO_H
+#define FOCUSERLINK_IO_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+
+#include "focuserlink_protocol.h"
+#include "focuserlink_schema.h"
+#include "focuserlink_motion.h"
+#include "focuserlink_port.h"
+#include "focuserlink_spsc.h"
+
+#define IO_QUEUE_SIZE       32
+// completions, failures and link loss held back while the event queue is full,
+// no new jobs are taken until they are out, a batch makes at most two per command
+#define IO_EVENT_OVERFLOW   (2 * IO_MAX_BATCH)
+// [ms] retry of held back events while jobs wait for them
+#define IO_OVERFLOW_RETRY   10
+
+// commands written to the device in one pipelined round trip
+#define IO_MAX_BATCH        8
+// batch slots kept for a settings write, a motion leg and the q, u and f polls
+#define IO_RESERVED         5
+
+// default polling cadences [ms]
+#define POLL_MOVING         50
+#define POLL_IDLE           2000
+#define POLL_ENVIRONMENT    5000
+#define POLL_SETTINGS       30000
+
+// settings changes arriving within this window go out as one U write [ms]
+#define SETTINGS_COALESCE   50
+
+// Work item sent from the INDI thread to the I/O session
+struct FocuserLinkJob
+{
+    enum Type
+    {
+        JOB_COMMAND,    // send command, reply letter must match
+        JOB_SETTINGS,   // patch fields of the u settings record
+        JOB_MOVE        // planned absolute move
+    } type;
+    char command[ASTROLINK4_LEN];
+    uint32_t ticket;    // completion to call, 0 for none
+    FocuserLinkSchema::SettingsPatch settings;
+    FocuserLinkMotionPlan plan;
+};
+
+// Result sent from the I/O session back to the INDI thread
+struct FocuserLinkEvent
+{
+    enum Type
+    {
+        EVENT_Q, EVENT_U, EVENT_F,
+        EVENT_DONE,     // command with completion finished, see complete()
+        EVENT_LINK_LOST,// device stopped answering, port has to be reopened
+        EVENT_FAILED,   // job with given command letter failed
+        EVENT_SERIAL    // exchange failure or line recovery posted by the front end, for logging
+    } type;
+    char command;
+    uint32_t ticket;
+    bool ok;
+    char reply[ASTROLINK4_LEN];     // EVENT_DONE, EVENT_U and EVENT_F: reply as received
+    FocuserLinkProtocol::QRecord q;
+    int32_t plannedSteps;   // EVENT_Q: steps of move legs not started yet
+    double eta;             // EVENT_Q: time to end of the planned move [s]
+    double rate;            // EVENT_Q: learned step rate [steps/s]
+    std::chrono::steady_clock::time_point time;  // EVENT_Q: when the reply was taken
+    FocuserLinkProtocol::URecord u;
+    FocuserLinkProtocol::FRecord f;
+    int code;               // EVENT_SERIAL: meaning and arg are up to the poster
+    int arg;
+};
+
+// Device session owning the serial port after handshake. All device traffic
+// goes through it, telemetry and job results are handed back through a
+// lock-free queue and a notification pipe the INDI event loop can watch.
+// Sessions of all devices in the process are driven by one shared reactor
+// thread (see FocuserLinkReactor), so nothing here may block on the port.
+//
+// Position is polled fast while the motor moves and slowly when idle, the
+// environment fields of the q reply and the u/f records have their own cadence.
+//
+// The last u record is kept as settings image. Settings jobs patch the image
+// and are coalesced into a single U write, no read back over serial needed.
+//
+// Commands, settings writes and due polls of one cycle are sent as a single
+// batch. With a port set they are written back to back and the replies
+// collected as they arrive, otherwise they are exchanged one by one.
+class FocuserLinkIO
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<bool(const char *cmd, char *res)> Exchange;
+    // called on the reactor thread after each batch on the port, results are in port
+    typedef std::function<void(FocuserLinkPort &port, const char *const *cmds, int n)> Report;
+    // called on the INDI thread with the device reply, res is empty on failure
+    typedef std::function<void(bool ok, const char *res)> Completion;
+
+    explicit FocuserLinkIO(Exchange exchange);
+    ~FocuserLinkIO();
+
+    // must be set before start(), nullptr uses the Exchange callback
+    void setPort(FocuserLinkPort *port, Report report)
+    {
+        this->port = port;
+        this->report = report;
+    }
+
+    bool start();
+    void stop();
+    bool isRunning() const
+    {
+        return running.load();
+    }
+
+    // read end of notification pipe, readable while events are pending
+    int notifyFD() const
+    {
+        return notifyPipe[0];
+    }
+
+    // INDI thread side
+    bool submit(const FocuserLinkJob &job);
+    // without completion a failed command is reported as EVENT_FAILED
+    bool submitCommand(const char *cmd, Completion done = nullptr);
+    bool submitSettings(const FocuserLinkSchema::SettingsPatch &patch);
+    // the whole plan runs on the reactor, done is called once the last leg started
+    bool submitMove(const FocuserLinkMotionPlan &plan, Completion done = nullptr);
+    bool nextEvent(FocuserLinkEvent &event);
+    // runs the completion of an EVENT_DONE event
+    void complete(const FocuserLinkEvent &event);
+    void clearNotify();
+    // position and settings updates dropped while the INDI thread was behind
+    unsigned long droppedEvents() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    // polling cadences [ms], may be changed while running
+    void setPolling(uint32_t movingMs, uint32_t idleMs, uint32_t environmentMs, uint32_t settingsMs);
+
+    // switch to fast polling until the device reports the motor stopped
+    void expectMotion();
+
+    // Reactor side. Advances the session, readable tells the port has data.
+    // Returns when it wants to be serviced again.
+    Clock::time_point service(Clock::time_point now, bool readable);
+    // port to watch while a batch is in flight, -1 otherwise
+    int pollFD() const;
+    // for Report and Exchange callbacks that gave up on the device
+    void reportLinkLost();
+    // for Report and Exchange callbacks, hands a failure to the INDI thread to log
+    void reportSerial(char command, int code, int arg);
+
+private:
+    // one command of the current batch
+    struct Entry
+    {
+        enum Kind
+        {
+            ENTRY_COMMAND, ENTRY_SETTINGS, ENTRY_MOVE, ENTRY_Q, ENTRY_U, ENTRY_F
+        } kind;
+        uint32_t ticket;
+        char command[ASTROLINK4_LEN];
+    };
+
+    void prepare(Clock::time_point now);
+    void add(Entry::Kind kind, const char *command, uint32_t ticket = 0);
+    uint32_t addCompletion(Completion done);
+    void startMove(const FocuserLinkJob &job);
+    void addLeg();
+    void finishMove(bool ok);
+    void queueSettings(const FocuserLinkJob &job);
+    void flushSettings();
+    void poll(Clock::time_point now);
+    void finishBatch();
+    Clock::time_point nextDue(Clock::time_point now) const;
+    void dispatch(const Entry &entry, bool ok, const char *res, Clock::time_point now);
+    void wakeUp();
+    void publish(const FocuserLinkEvent &event);
+    void flushOverflow();
+    void notify();
+    void failed(char command);
+
+    Exchange exchange;
+    FocuserLinkPort *port = nullptr;
+    Report report;
+    std::atomic<bool> running { false };
+    std::atomic<bool> motionExpected { false };
+    std::atomic<bool> rescheduled { false };
+    std::atomic<uint32_t> movingInterval { POLL_MOVING };
+    std::atomic<uint32_t> idleInterval { POLL_IDLE };
+    std::atomic<uint32_t> environmentInterval { POLL_ENVIRONMENT };
+    std::atomic<uint32_t> settingsInterval { POLL_SETTINGS };
+    int notifyPipe[2] { -1, -1 };
+    // set when even the overflow was full, nextEvent reports it last
+    std::atomic<bool> linkLostPending { false };
+    std::atomic<unsigned long> dropped { 0 };
+
+    SpscQueue<FocuserLinkJob, IO_QUEUE_SIZE> jobs;
+    SpscQueue<FocuserLinkEvent, IO_QUEUE_SIZE> events;
+
+    // INDI thread only
+    uint32_t lastTicket = 0;
+    std::map<uint32_t, Completion> completions;
+
+    // reactor thread only
+    Entry entries[IO_MAX_BATCH];
+    int entryCount = 0;
+    bool environmentDue = false;
+    FocuserLinkEvent overflow[IO_EVENT_OVERFLOW];
+    int overflowCount = 0;
+
+    FocuserLinkMotion motion;
+    uint32_t moveTicket = 0;
+    bool legAcked = false;      // R for the current leg was answered
+    bool legDue = false;        // previous leg done, next one goes out with the next batch
+    bool settingsStale = true;
+    bool manualStale = true;
+    bool moving = false;
+    Clock::time_point nextPosition;
+    Clock::time_point nextEnvironment;
+    Clock::time_point nextSettings;
+
+    char settingsImage[ASTROLINK4_LEN];
+    bool settingsValid = false;
+    int pendingCount = 0;
+    int pendingIndex[FOCUSERLINK_MAX_FIELDS];
+    char pendingValue[FOCUSERLINK_MAX_FIELDS][SCHEMA_VALUE_LEN];
+    Clock::time_point flushAt;
+};
+
+#endif
@@ -0,0 +1,267 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_metrics.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// how long a client may take to send its request before it gets plain text [ms]
+#define METRICS_REQUEST_WAIT 200
+// the same while further connections wait to be accepted [ms]
+#define METRICS_BUSY_WAIT    10
+
+struct MetricInfo
+{
+    const char *name;
+    const char *type;
+    const char *help;
+};
+
+static const MetricInfo METRICS[METRIC_COUNT] =
+{
+    { "connected", "gauge", "1 while the controller is connected" },
+    { "position_steps", "gauge", "Focuser position" },
+    { "steps_to_go", "gauge", "Steps left of the current move" },
+    { "moving", "gauge", "1 while the focuser moves" },
+    { "temperature_celsius", "gauge", "Raw sensor temperature" },
+    { "temperature_filtered_celsius", "gauge", "Filtered sensor temperature" },
+    { "humidity_percent", "gauge", "Raw relative humidity" },
+    { "dewpoint_celsius", "gauge", "Raw dew point" },
+    { "compensation_diff_steps", "gauge", "Pending temperature compensation" },
+    { "poll_cycle_seconds", "gauge", "Time between the last two position polls" },
+    { "publish_sent_total", "counter", "Property updates sent to clients" },
+    { "publish_suppressed_total", "counter", "Property updates suppressed as unchanged" },
+    { "events_dropped_total", "counter", "Position and settings updates dropped while the driver was behind" },
+};
+
+// round trip histogram buckets [us]
+static const uint32_t LATENCY_BUCKETS[] = { 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000 };
+
+FocuserLinkMetrics::FocuserLinkMetrics(const FocuserLinkStats &stats) : stats(stats)
+{
+    for (std::atomic<double> &gauge : gauges)
+        gauge.store(NAN, std::memory_order_relaxed);
+}
+
+FocuserLinkMetrics::~FocuserLinkMetrics()
+{
+    stop();
+}
+
+bool FocuserLinkMetrics::start(const char *path)
+{
+    stop();
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        savedErrno = ENAMETOOLONG;
+        return false;
+    }
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    // a socket left behind by a previous run is replaced, anything else is kept
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        savedErrno = errno;
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    // bound, the socket file exists from here on
+    if (listen(fd, 4) < 0 || pipe2(wakePipe, O_CLOEXEC) < 0)
+    {
+        savedErrno = errno;
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    listenFD = fd;
+    socketPath = path;
+    server = std::thread(&FocuserLinkMetrics::serve, this);
+    return true;
+}
+
+void FocuserLinkMetrics::stop()
+{
+    if (listenFD < 0)
+        return;
+
+    char wake = 0;
+    if (write(wakePipe[1], &wake, 1) < 0)
+        savedErrno = errno;
+    server.join();
+
+    close(listenFD);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    listenFD = wakePipe[0] = wakePipe[1] = -1;
+    unlink(socketPath.c_str());
+}
+
+void FocuserLinkMetrics::serve()
+{
+    while (true)
+    {
+        struct pollfd fds[2] = { { listenFD, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents)
+            return;
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept4(listenFD, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0)
+            {
+                answer(client);
+                close(client);
+            }
+        }
+    }
+}
+
+void FocuserLinkMetrics::answer(int fd)
+{
+    char request[512];
+    ssize_t n = 0;
+    // clients are answered one after another, an idle one must not hold up
+    // the scrapes queued behind it
+    struct pollfd fds[2] = { { fd, POLLIN, 0 }, { listenFD, POLLIN, 0 } };
+    bool ready = poll(fds, 2, METRICS_REQUEST_WAIT) > 0 && (fds[0].revents & POLLIN);
+    if (!ready && (fds[1].revents & POLLIN))
+        ready = poll(fds, 1, METRICS_BUSY_WAIT) > 0;
+    if (ready)
+        n = recv(fd, request, sizeof(request) - 1, 0);
+
+    std::string body;
+    snapshot(body);
+
+    std::string response;
+    if (n >= 4 && !strncmp(request, "GET ", 4))
+    {
+        char header[160];
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body.size());
+        response = header;
+    }
+    response += body;
+
+    size_t offset = 0;
+    while (offset < response.size())
+    {
+        ssize_t written = send(fd, response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        offset += written;
+    }
+}
+
+void FocuserLinkMetrics::snapshot(std::string &text) const
+{
+    char line[512];
+    text.clear();
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        double value = gauges[i].load(std::memory_order_relaxed);
+        // no reading yet, e.g. no sensor connected
+        if (std::isnan(value))
+            continue;
+        snprintf(line, sizeof(line), "# HELP focuserlink_%s %s\n# TYPE focuserlink_%s %s\nfocuserlink_%s{device=\"%s\"} %.15g\n",
+                 METRICS[i].name, METRICS[i].help, METRICS[i].name, METRICS[i].type, METRICS[i].name, device.c_str(), value);
+        text += line;
+    }
+
+    static const struct
+    {
+        const char *name;
+        uint64_t FocuserLinkStats::Summary::*field;
+    } counters[] =
+    {
+        { "serial_timeouts_total", &FocuserLinkStats::Summary::timeouts },
+        { "serial_framing_errors_total", &FocuserLinkStats::Summary::framing },
+        { "serial_errors_total", &FocuserLinkStats::Summary::errors },
+        { "serial_discarded_frames_total", &FocuserLinkStats::Summary::discarded },
+    };
+
+    FocuserLinkStats::Summary summaries[STATS_COMMAND_COUNT];
+    for (int c = 0; c < STATS_COMMAND_COUNT; c++)
+        stats.summary(c, summaries[c]);
+
+    for (const auto &counter : counters)
+    {
+        snprintf(line, sizeof(line), "# TYPE focuserlink_%s counter\n", counter.name);
+        text += line;
+        for (int c = 0; c < STATS_COMMAND_COUNT; c++)
+        {
+            if (summaries[c].count == 0 && summaries[c].discarded == 0)
+                continue;
+            snprintf(line, sizeof(line), "focuserlink_%s{device=\"%s\",command=\"%c\"} %llu\n", counter.name, device.c_str(),
+                     FocuserLinkStats::commandAt(c), static_cast<unsigned long long>(summaries[c].*counter.field));
+            text += line;
+        }
+    }
+
+    // bucket counts are read after the summary, they may run ahead of its count a little
+    text += "# HELP focuserlink_serial_round_trip_seconds Serial command round trip\n";
+    text += "# TYPE focuserlink_serial_round_trip_seconds histogram\n";
+    for (int c = 0; c < STATS_COMMAND_COUNT; c++)
+    {
+        const FocuserLinkStats::Summary &summary = summaries[c];
+        if (summary.count == 0)
+            continue;
+        char command = FocuserLinkStats::commandAt(c);
+        for (uint32_t limit : LATENCY_BUCKETS)
+        {
+            snprintf(line, sizeof(line), "focuserlink_serial_round_trip_seconds_bucket{device=\"%s\",command=\"%c\",le=\"%g\"} %llu\n",
+                     device.c_str(), command, limit / 1e6,
+                     static_cast<unsigned long long>(std::min(stats.countBelow(c, limit), summary.count)));
+            text += line;
+        }
+        snprintf(line, sizeof(line),
+                 "focuserlink_serial_round_trip_seconds_bucket{device=\"%s\",command=\"%c\",le=\"+Inf\"} %llu\n"
+                 "focuserlink_serial_round_trip_seconds_sum{device=\"%s\",command=\"%c\"} %.6f\n"
+                 "focuserlink_serial_round_trip_seconds_count{device=\"%s\",command=\"%c\"} %llu\n",
+                 device.c_str(), command, static_cast<unsigned long long>(summary.count), device.c_str(), command,
+                 summary.totalMicros / 1e6, device.c_str(), command, static_cast<unsigned long long>(summary.count));
+        text += line;
+    }
+}
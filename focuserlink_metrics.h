@@ -0,0 +1,96 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_METRICS_H
+#define FOCUSERLINK_METRICS_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "focuserlink_stats.h"
+
+// Gauges and counters set by the driver, exported as focuserlink_<name>
+enum FocuserLinkMetric
+{
+    METRIC_CONNECTED,
+    METRIC_POSITION,
+    METRIC_STEPS_TO_GO,
+    METRIC_MOVING,
+    METRIC_TEMPERATURE,
+    METRIC_TEMPERATURE_FILTERED,
+    METRIC_HUMIDITY,
+    METRIC_DEWPOINT,
+    METRIC_COMP_DIFF,
+    METRIC_POLL_CYCLE,
+    METRIC_PUBLISH_SENT,
+    METRIC_PUBLISH_SUPPRESSED,
+    METRIC_EVENTS_DROPPED,
+    METRIC_COUNT
+};
+
+// Prometheus text endpoint on a Unix domain socket. The driver stores values
+// with relaxed atomic writes and the serial statistics are atomic already, so
+// the server thread formats a snapshot without taking any lock the poll path
+// uses. A request starting with GET is answered as HTTP/1.0, any other
+// connection gets the plain text, e.g. curl --unix-socket or nc -U.
+class FocuserLinkMetrics
+{
+public:
+    explicit FocuserLinkMetrics(const FocuserLinkStats &stats);
+    ~FocuserLinkMetrics();
+
+    // device label of all series, set before start()
+    void setDevice(const char *name)
+    {
+        device = name;
+    }
+
+    bool start(const char *path);
+    void stop();
+    bool running() const
+    {
+        return listenFD >= 0;
+    }
+    int lastErrno() const
+    {
+        return savedErrno;
+    }
+
+    void set(FocuserLinkMetric metric, double value)
+    {
+        gauges[metric].store(value, std::memory_order_relaxed);
+    }
+
+    void snapshot(std::string &text) const;
+
+private:
+    void serve();
+    void answer(int fd);
+
+    const FocuserLinkStats &stats;
+    std::string device;
+    std::string socketPath;
+    std::atomic<double> gauges[METRIC_COUNT];
+    std::thread server;
+    int listenFD = -1;
+    int wakePipe[2] { -1, -1 };
+    int savedErrno = 0;
+};
+
+#endif
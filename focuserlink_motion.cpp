@@ -0,0 +1,99 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_motion.h"
+
+#include <cstdlib>
+
+FocuserLinkMotionPlan FocuserLinkMotion::plan(uint32_t current, uint32_t target, int32_t backlash, uint32_t maxPos)
+{
+    FocuserLinkMotionPlan plan;
+    plan.legCount = 1;
+    plan.legs[0] = target;
+
+    if (backlash == 0 || target == current || (target > current) != (backlash > 0))
+        return plan;
+
+    // signed 64 bit, so an overshoot below zero is not wrapped into a huge target
+    int64_t overshoot = static_cast<int64_t>(target) + backlash;
+    if (overshoot < 0 || overshoot > maxPos)
+        return plan;
+
+    plan.legCount = 2;
+    plan.legs[0] = static_cast<uint32_t>(overshoot);
+    plan.legs[1] = target;
+    return plan;
+}
+
+void FocuserLinkMotion::begin(const FocuserLinkMotionPlan &plan)
+{
+    current = plan;
+    leg = 0;
+    hasSample = false;
+}
+
+void FocuserLinkMotion::cancel()
+{
+    leg = current.legCount;
+    hasSample = false;
+}
+
+bool FocuserLinkMotion::advance()
+{
+    if (leg < current.legCount)
+        leg++;
+    hasSample = false;
+    return active();
+}
+
+void FocuserLinkMotion::sample(int32_t position, int32_t stepsToGo, Clock::time_point time)
+{
+    if (stepsToGo == 0)
+    {
+        hasSample = false;
+        return;
+    }
+
+    if (hasSample)
+    {
+        double dt = std::chrono::duration<double>(time - lastTime).count();
+        int32_t steps = std::abs(position - lastPosition);
+        if (dt > 0.01 && steps > 0)
+            stepRate += 0.5 * (steps / dt - stepRate);
+    }
+    hasSample = true;
+    lastPosition = position;
+    lastTime = time;
+}
+
+int32_t FocuserLinkMotion::plannedSteps() const
+{
+    int32_t steps = 0;
+    for (int i = leg + 1; i < current.legCount; i++)
+        steps += std::abs(static_cast<int32_t>(current.legs[i] - current.legs[i - 1]));
+    return steps;
+}
+
+double FocuserLinkMotion::legEta(int32_t stepsToGo) const
+{
+    return std::abs(stepsToGo) / stepRate;
+}
+
+double FocuserLinkMotion::eta(int32_t stepsToGo) const
+{
+    return (std::abs(stepsToGo) + plannedSteps()) / stepRate;
+}
@@ -0,0 +1,90 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_MOTION_H
+#define FOCUSERLINK_MOTION_H
+
+#include <chrono>
+#include <stdint.h>
+
+#define MOTION_MAX_LEGS     2
+
+// step rate assumed until the first moving samples are in [steps/s]
+#define MOTION_DEFAULT_RATE 500
+
+// completion poll is placed this long after the modelled end of a leg [ms]
+#define MOTION_ETA_MARGIN   10
+
+// Absolute move split into legs, e.g. backlash overshoot and return
+struct FocuserLinkMotionPlan
+{
+    int legCount;
+    uint32_t legs[MOTION_MAX_LEGS];
+};
+
+// Planned move followed by the I/O worker. The next leg is started as soon as
+// a poll sees the previous one done, the step rate is learned from the polls
+// to estimate time to arrival.
+class FocuserLinkMotion
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Moves in the backlash direction overshoot by backlash steps and return
+    // to target. No overshoot when it would leave 0..maxPos.
+    static FocuserLinkMotionPlan plan(uint32_t current, uint32_t target, int32_t backlash, uint32_t maxPos);
+
+    void begin(const FocuserLinkMotionPlan &plan);
+    void cancel();
+
+    bool active() const
+    {
+        return leg < current.legCount;
+    }
+    uint32_t target() const
+    {
+        return current.legs[leg];
+    }
+    // moves on to the next leg, false when the plan is finished
+    bool advance();
+
+    // position poll while moving, updates the step rate
+    void sample(int32_t position, int32_t stepsToGo, Clock::time_point time);
+
+    // steps of legs not started yet
+    int32_t plannedSteps() const;
+    // time to end of the current leg and of the whole plan [s]
+    double legEta(int32_t stepsToGo) const;
+    double eta(int32_t stepsToGo) const;
+
+    double rate() const
+    {
+        return stepRate;
+    }
+
+private:
+    FocuserLinkMotionPlan current { 0, { 0, 0 } };
+    int leg = 0;
+
+    double stepRate = MOTION_DEFAULT_RATE;
+    bool hasSample = false;
+    int32_t lastPosition = 0;
+    Clock::time_point lastTime;
+};
+
+#endif
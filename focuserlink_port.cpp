@@ -0,0 +1,267 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_port.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static int remainingMs(Clock::time_point deadline)
+{
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    return (remaining > 0) ? static_cast<int>(remaining) : 0;
+}
+
+void FocuserLinkPort::attach(int fd)
+{
+    portFD = fd;
+    savedErrno = 0;
+    framer.reset();
+}
+
+FocuserLinkPort::Result FocuserLinkPort::exchange(const char *cmd, char *res, int timeoutMs)
+{
+    Result rc = write(&cmd, 1);
+    if (rc != PORT_OK)
+        return rc;
+    return readReply(cmd[0], res, timeoutMs);
+}
+
+FocuserLinkPort::Result FocuserLinkPort::transact(const char *const *cmds, char (*res)[ASTROLINK4_LEN], Result *rc,
+        uint32_t *micros, int n, const int *timeoutsMs)
+{
+    Result written = begin(cmds, n, timeoutsMs);
+    if (written == PORT_OK)
+    {
+        while (!match())
+        {
+            if (fill(std::max(remainingMs(nextDeadline), 1)) == PORT_ERROR)
+            {
+                abandon(PORT_ERROR);
+                break;
+            }
+        }
+    }
+
+    Result overall = PORT_OK;
+    for (int i = 0; i < n; i++)
+    {
+        rc[i] = results[i];
+        micros[i] = this->micros[i];
+        if (rc[i] == PORT_OK)
+            memcpy(res[i], replies[i], ASTROLINK4_LEN);
+        else if (overall == PORT_OK || rc[i] == PORT_ERROR)
+            overall = rc[i];
+    }
+    finish();
+    return overall;
+}
+
+FocuserLinkPort::Result FocuserLinkPort::begin(const char *const *cmds, int n, const int *timeoutsMs)
+{
+    started = nextDeadline = Clock::now();
+    batchSize = std::min(n, PORT_MAX_BATCH);
+    for (int i = 0; i < batchSize; i++)
+    {
+        letters[i] = cmds[i][0];
+        timeouts[i] = timeoutsMs[i];
+        waiting[i] = true;
+        results[i] = PORT_TIMEOUT;
+        micros[i] = 0;
+        replies[i][0] = '\0';
+    }
+
+    Result written = PORT_ERROR;
+    if (n <= PORT_MAX_BATCH)
+        written = write(cmds, n);
+    else
+        savedErrno = EINVAL;
+    if (written != PORT_OK)
+        abandon(written);
+    return written;
+}
+
+bool FocuserLinkPort::update(bool readable)
+{
+    if (readable && readAvailable() == PORT_ERROR)
+    {
+        abandon(PORT_ERROR);
+        return true;
+    }
+    return match();
+}
+
+bool FocuserLinkPort::match()
+{
+    char frame[ASTROLINK4_LEN];
+    while (true)
+    {
+        // letters of unanswered commands in order, replies come back in the same order
+        char expected[PORT_MAX_BATCH + 1] = { '\0' };
+        int slots[PORT_MAX_BATCH];
+        int count = 0;
+        Clock::time_point now = Clock::now();
+        // the device works through commands in order, each deadline starts when
+        // the previous command was answered or given up
+        Clock::time_point anchor = started;
+        for (int i = 0; i < batchSize; i++)
+        {
+            if (waiting[i])
+            {
+                Clock::time_point deadline = anchor + std::chrono::milliseconds(timeouts[i]);
+                if (deadline <= now)
+                {
+                    waiting[i] = false;
+                    resolved[i] = deadline;
+                    micros[i] = std::chrono::duration_cast<std::chrono::microseconds>(deadline - started).count();
+                }
+                else
+                {
+                    if (count == 0)
+                        nextDeadline = deadline;
+                    anchor = deadline;
+                    if (strchr(expected, letters[i]) == nullptr)
+                    {
+                        expected[count] = letters[i];
+                        slots[count++] = i;
+                        expected[count] = '\0';
+                    }
+                    continue;
+                }
+            }
+            anchor = resolved[i];
+        }
+        if (count == 0)
+            return true;
+
+        int match = framer.nextReply(expected, frame, ASTROLINK4_LEN);
+        if (match < 0)
+            return false;
+
+        int i = slots[match];
+        memcpy(replies[i], frame, ASTROLINK4_LEN);
+        results[i] = PORT_OK;
+        waiting[i] = false;
+        resolved[i] = Clock::now();
+        micros[i] = std::chrono::duration_cast<std::chrono::microseconds>(resolved[i] - started).count();
+    }
+}
+
+void FocuserLinkPort::abandon(Result rc)
+{
+    for (int i = 0; i < batchSize; i++)
+    {
+        if (waiting[i])
+            results[i] = rc;
+        waiting[i] = false;
+    }
+}
+
+FocuserLinkPort::Result FocuserLinkPort::write(const char *const *cmds, int n)
+{
+    char buf[PORT_MAX_BATCH * (ASTROLINK4_LEN + 1)];
+    int len = 0;
+    for (int i = 0; i < n && i < PORT_MAX_BATCH; i++)
+    {
+        int cmdLen = strnlen(cmds[i], ASTROLINK4_LEN - 1);
+        memcpy(buf + len, cmds[i], cmdLen);
+        len += cmdLen;
+        buf[len++] = '\n';
+    }
+
+    // a full output buffer that does not drain in time is a device gone
+    // silent, the caller would otherwise stall its whole event loop on it
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(PORT_WRITE_TIMEOUT);
+    int offset = 0;
+    while (offset < len)
+    {
+        ssize_t written = ::write(portFD, buf + offset, len - offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+            {
+                int wait = remainingMs(deadline);
+                if (wait <= 0)
+                {
+                    savedErrno = ETIMEDOUT;
+                    return PORT_ERROR;
+                }
+                struct pollfd pfd = { portFD, POLLOUT, 0 };
+                poll(&pfd, 1, wait);
+                continue;
+            }
+            savedErrno = errno;
+            return PORT_ERROR;
+        }
+        offset += written;
+    }
+    return PORT_OK;
+}
+
+FocuserLinkPort::Result FocuserLinkPort::readReply(char expected, char *res, int timeoutMs)
+{
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!framer.nextReply(expected, res, ASTROLINK4_LEN))
+    {
+        int wait = remainingMs(deadline);
+        if (wait <= 0)
+            return PORT_TIMEOUT;
+        if (fill(wait) == PORT_ERROR)
+            return PORT_ERROR;
+    }
+    return PORT_OK;
+}
+
+FocuserLinkPort::Result FocuserLinkPort::fill(int timeoutMs)
+{
+    struct pollfd pfd = { portFD, POLLIN, 0 };
+    int rc = poll(&pfd, 1, timeoutMs);
+    if (rc < 0)
+    {
+        if (errno == EINTR)
+            return PORT_OK;
+        savedErrno = errno;
+        return PORT_ERROR;
+    }
+    if (rc == 0)
+        return PORT_TIMEOUT;
+    return readAvailable();
+}
+
+FocuserLinkPort::Result FocuserLinkPort::readAvailable()
+{
+    char buf[ASTROLINK4_LEN];
+    ssize_t n = read(portFD, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return PORT_OK;
+    if (n <= 0)
+    {
+        // end of file means the device went away
+        savedErrno = (n == 0) ? EIO : errno;
+        return PORT_ERROR;
+    }
+    framer.feed(buf, n);
+    return PORT_OK;
+}
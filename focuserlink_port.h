@@ -0,0 +1,134 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_PORT_H
+#define FOCUSERLINK_PORT_H
+
+#include <chrono>
+#include <stdint.h>
+
+#include "focuserlink_framer.h"
+
+// maximum number of commands written in one pipelined transaction
+#define PORT_MAX_BATCH      8
+// [ms] a write the device has not taken within this time is a lost link
+#define PORT_WRITE_TIMEOUT  250
+
+// Line protocol on an open serial (or pty) file descriptor. Commands can be
+// written back to back and the replies collected afterwards, matched to their
+// commands by letter and order.
+class FocuserLinkPort
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Result
+    {
+        PORT_OK = 0,
+        PORT_TIMEOUT,
+        PORT_ERROR      // errno is kept in lastErrno()
+    };
+
+    void attach(int fd);
+    int fd() const
+    {
+        return portFD;
+    }
+
+    // single command, reply without terminator is stored in res
+    Result exchange(const char *cmd, char *res, int timeoutMs);
+
+    // writes all n commands in one go, then collects the replies. Per command
+    // result and round trip time [us] are stored in rc and micros. The device
+    // answers in order, so reply i is due within the sum of timeoutsMs[0..i].
+    Result transact(const char *const *cmds, char (*res)[ASTROLINK4_LEN], Result *rc, uint32_t *micros, int n,
+                    const int *timeoutsMs);
+
+    // Same without blocking, for an event loop watching fd(). begin() writes
+    // the commands, update() is called when fd() is readable or deadline()
+    // passed and returns true once every command is answered or given up.
+    Result begin(const char *const *cmds, int n, const int *timeoutsMs);
+    bool update(bool readable);
+    bool busy() const
+    {
+        return batchSize > 0;
+    }
+    Clock::time_point deadline() const
+    {
+        return nextDeadline;
+    }
+    // when the commands of the transaction were written
+    Clock::time_point startTime() const
+    {
+        return started;
+    }
+    const char *reply(int i) const
+    {
+        return replies[i];
+    }
+    Result result(int i) const
+    {
+        return results[i];
+    }
+    // [us], time given up for commands that timed out
+    uint32_t roundTrip(int i) const
+    {
+        return micros[i];
+    }
+    // ends the transaction, results stay readable until the next begin()
+    void finish()
+    {
+        batchSize = 0;
+    }
+
+    Result write(const char *const *cmds, int n);
+    Result readReply(char expected, char *res, int timeoutMs);
+
+    unsigned long discarded() const
+    {
+        return framer.discarded();
+    }
+    int lastErrno() const
+    {
+        return savedErrno;
+    }
+
+private:
+    Result fill(int timeoutMs);
+    Result readAvailable();
+    bool match();
+    void abandon(Result rc);
+
+    int portFD = -1;
+    int savedErrno = 0;
+    FocuserLinkFramer framer;
+
+    // transaction in progress
+    int batchSize = 0;
+    char letters[PORT_MAX_BATCH];
+    int timeouts[PORT_MAX_BATCH];
+    bool waiting[PORT_MAX_BATCH];
+    Clock::time_point resolved[PORT_MAX_BATCH];
+    Clock::time_point started;
+    Clock::time_point nextDeadline;
+    Result results[PORT_MAX_BATCH];
+    uint32_t micros[PORT_MAX_BATCH];
+    char replies[PORT_MAX_BATCH][ASTROLINK4_LEN];
+};
+
+#endif
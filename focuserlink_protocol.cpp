@@ -0,0 +1,185 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_protocol.h"
+#include "focuserlink_schema.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace FocuserLinkProtocol
+{
+
+int parseFields(const char *res, double *fields, int maxFields)
+{
+    if (res == nullptr || res[0] == '\0' || maxFields < 1)
+        return -1;
+
+    int count = 0;
+    fields[count++] = 0;
+
+    const char *p = res + 1;
+    while (*p == ':')
+    {
+        if (count >= maxFields)
+            return -1;
+
+        ++p;
+        char *end = nullptr;
+        double value = strtod(p, &end);
+        while (*end == ' ' || *end == '\r')
+            ++end;
+        if (end == p || (*end != ':' && *end != '\0'))
+        {
+            // keep field position but mark it as not a number
+            value = NAN;
+            while (*end != ':' && *end != '\0')
+                ++end;
+        }
+        fields[count++] = value;
+        p = end;
+    }
+
+    // anything but end of string here means there was no separator after command letter
+    return (*p == '\0') ? count : -1;
+}
+
+bool parseQ(const char *res, QRecord &record)
+{
+    uint32_t parsed;
+    if (FocuserLinkSchema::parse<FocuserLinkSchema::QLayout>(res, record, parsed) < 0
+            || (parsed & FocuserLinkSchema::QLayout::requiredFields) != FocuserLinkSchema::QLayout::requiredFields)
+        return false;
+    record.hasEnvironment = parsed == FocuserLinkSchema::QLayout::allFields;
+    return true;
+}
+
+bool parseU(const char *res, URecord &record)
+{
+    uint32_t parsed;
+    return FocuserLinkSchema::parse<FocuserLinkSchema::ULayout>(res, record, parsed) >= 0
+           && parsed == FocuserLinkSchema::ULayout::allFields;
+}
+
+bool parseF(const char *res, FRecord &record)
+{
+    uint32_t parsed;
+    return FocuserLinkSchema::parse<FocuserLinkSchema::FLayout>(res, record, parsed) >= 0
+           && parsed == FocuserLinkSchema::FLayout::allFields;
+}
+
+bool formatPatched(const char *res, char setCom, const int *indices, const char *const *values, int n, char *out, int outLen)
+{
+    if (res == nullptr || res[0] == '\0' || outLen < 2)
+        return false;
+
+    int len = 0;
+    out[len++] = setCom;
+
+    int index = 1;
+    const char *p = res + 1;
+    while (*p == ':')
+    {
+        ++p;
+        const char *end = strchr(p, ':');
+        if (end == nullptr)
+            end = p + strlen(p);
+
+        const char *field = p;
+        int fieldLen = end - p;
+        for (int i = 0; i < n; i++)
+        {
+            if (indices[i] == index)
+            {
+                field = values[i];
+                fieldLen = strlen(values[i]);
+            }
+        }
+
+        if (len + 1 + fieldLen + 1 >= outLen)
+            return false;
+        out[len++] = ':';
+        memcpy(out + len, field, fieldLen);
+        len += fieldLen;
+
+        index++;
+        p = end;
+    }
+    if (*p != '\0')
+        return false;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (indices[i] <= 0 || indices[i] >= index)
+            return false;
+    }
+
+    out[len++] = ':';
+    out[len] = '\0';
+    return true;
+}
+
+static bool fits(int n, int len)
+{
+    return n > 0 && n < len;
+}
+
+bool formatMove(uint32_t target, char *out, int len)
+{
+    return fits(snprintf(out, len, "R:0:%u", target), len);
+}
+
+bool formatSync(uint32_t position, char *out, int len)
+{
+    return fits(snprintf(out, len, "P:%u", position), len);
+}
+
+bool formatManual(bool manual, char *out, int len)
+{
+    return fits(snprintf(out, len, "F:%d", manual ? 1 : 0), len);
+}
+
+bool formatCompensate(uint16_t threshold, char *out, int len)
+{
+    return fits(snprintf(out, len, "S:%u", threshold), len);
+}
+
+bool isHandshake(const char *res)
+{
+    return res != nullptr && strncmp(res, HANDSHAKE_REPLY, strlen(HANDSHAKE_REPLY)) == 0;
+}
+
+int replyTimeout(char command)
+{
+    switch (command)
+    {
+        case 'q':
+        case 'u':
+        case 'f':
+            return TIMEOUT_STATUS;
+        case 'U':
+            return TIMEOUT_SETTINGS;
+        case '#':
+            return TIMEOUT_HANDSHAKE;
+        default:
+            return TIMEOUT_COMMAND;
+    }
+}
+
+}
@@ -0,0 +1,123 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_PROTOCOL_H
+#define FOCUSERLINK_PROTOCOL_H
+
+#include <stdint.h>
+
+// maximum length of a command or reply line
+#define ASTROLINK4_LEN      100
+
+#define Q_STEPPER_POS		1
+#define Q_STEPS_TO_GO		2
+#define Q_SENS1_TYPE		3
+#define Q_SENS1_TEMP		4
+#define Q_SENS1_HUM			5
+#define Q_SENS1_DEW			6
+#define Q_COMP_DIFF			7
+
+#define U_MAX_POS			5
+#define U_REVERSED			6
+#define U_STEPSIZE			7
+#define U_COMPSTEP          8
+#define U_COMPCYCLE         9
+#define U_COMPTRIGGER       10
+#define U_COMPAUTO          11
+
+#define F_MANUAL            1
+
+// commands without arguments
+#define COMMAND_HANDSHAKE   "#"
+#define COMMAND_STOP        "H"
+// identification returned for the handshake
+#define HANDSHAKE_REPLY     "#:FocuserLink"
+
+// maximum number of ':' separated fields in a single reply, command letter included
+#define FOCUSERLINK_MAX_FIELDS 32
+
+// reply deadlines [ms]
+#define TIMEOUT_STATUS      250     // q, u and f reads
+#define TIMEOUT_COMMAND     1000    // motion and mode commands
+#define TIMEOUT_SETTINGS    2000    // U, device writes its EEPROM before replying
+#define TIMEOUT_HANDSHAKE   3000    // #, board may still be starting after the port opened
+
+namespace FocuserLinkProtocol
+{
+
+// "q" reply - focuser position and environment sensor
+struct QRecord
+{
+    int32_t stepperPos;
+    int32_t stepsToGo;
+    bool hasEnvironment;    // reply long enough to carry sensor and compensation fields
+    int sens1Type;
+    double sens1Temp;
+    double sens1Hum;
+    double sens1Dew;
+    double compDiff;
+};
+
+// "u" reply - persistent focuser settings, scaled as described in focuserlink_schema.h
+struct URecord
+{
+    uint32_t maxPos;
+    bool reversed;
+    double stepSize;        // [um]
+    double compStep;        // [steps/C]
+    double compCycle;       // [s]
+    double compTrigger;     // [steps]
+    bool compAuto;
+};
+
+// "f" reply - hand controller state
+struct FRecord
+{
+    bool manual;
+};
+
+// Splits reply in place into numeric fields without allocating. Field 0 is the
+// command letter and is stored as 0, non numeric fields are stored as NaN.
+// Returns number of fields or -1 when reply is malformed or too long.
+int parseFields(const char *res, double *fields, int maxFields);
+
+// records laid out by focuserlink_schema.h
+bool parseQ(const char *res, QRecord &record);
+bool parseU(const char *res, URecord &record);
+bool parseF(const char *res, FRecord &record);
+
+// Builds a set command from a get reply, e.g. "u:..." into "U:...:", replacing
+// n fields given by indices. Returns false if an index is out of range or the
+// result does not fit into out.
+bool formatPatched(const char *res, char setCom, const int *indices, const char *const *values, int n, char *out, int outLen);
+
+// Command lines with arguments, false when out is too short
+bool formatMove(uint32_t target, char *out, int len);           // R:0:target, motor 0
+bool formatSync(uint32_t position, char *out, int len);         // P:position
+bool formatManual(bool manual, char *out, int len);             // F:0 or F:1
+bool formatCompensate(uint16_t threshold, char *out, int len);  // S:threshold [steps]
+
+// reply to COMMAND_HANDSHAKE comes from a FocuserLink controller
+bool isHandshake(const char *res);
+
+// reply deadline for command letter [ms]
+int replyTimeout(char command);
+
+}
+
+#endif
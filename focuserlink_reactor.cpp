@@ -0,0 +1,150 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_reactor.h"
+#include "focuserlink_io.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+FocuserLinkReactor &FocuserLinkReactor::instance()
+{
+    // never destroyed, sessions may still be stopped from static destructors
+    static FocuserLinkReactor *reactor = new FocuserLinkReactor();
+    return *reactor;
+}
+
+bool FocuserLinkReactor::add(FocuserLinkIO *session)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running)
+    {
+        if (pipe(wakePipe) != 0)
+            return false;
+        fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+        wakeWriteFD = wakePipe[1];
+        running = true;
+        worker = std::thread(&FocuserLinkReactor::run, this);
+    }
+    sessions.push_back(session);
+    wake();
+    return true;
+}
+
+void FocuserLinkReactor::remove(FocuserLinkIO *session)
+{
+    std::thread stopped;
+    int stoppedPipe[2];
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
+        if (!sessions.empty() || !running)
+            return;
+        running = false;
+        wake();
+        wakeWriteFD = -1;
+        stopped.swap(worker);
+        // a new session may start the next thread while this one winds down
+        for (int i = 0; i < 2; i++)
+        {
+            stoppedPipe[i] = wakePipe[i];
+            wakePipe[i] = -1;
+        }
+    }
+
+    stopped.join();
+    while (waking.load() > 0)
+        std::this_thread::yield();
+    for (int i = 0; i < 2; i++)
+        close(stoppedPipe[i]);
+}
+
+void FocuserLinkReactor::wake()
+{
+    char c = 1;
+    waking++;
+    int fd = wakeWriteFD.load();
+    if (fd >= 0 && write(fd, &c, 1) < 0)
+    {
+        // pipe full, reactor is already signalled
+    }
+    waking--;
+}
+
+size_t FocuserLinkReactor::size()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return sessions.size();
+}
+
+void FocuserLinkReactor::run()
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<struct pollfd> fds;
+    std::vector<FocuserLinkIO *> watched;
+    std::vector<FocuserLinkIO *> readable;
+    int wakeFD = wakePipe[0];
+
+    // runs until remove() hands the pipe back, a later thread gets a new one
+    std::unique_lock<std::mutex> guard(lock);
+    while (wakePipe[0] == wakeFD)
+    {
+        // sessions are serviced under the lock, so remove() waits for the pass to end
+        Clock::time_point now = Clock::now();
+        Clock::time_point due = now + std::chrono::seconds(1);
+        fds.clear();
+        watched.clear();
+        fds.push_back({ wakeFD, POLLIN, 0 });
+        for (FocuserLinkIO *session : sessions)
+        {
+            bool ready = std::find(readable.begin(), readable.end(), session) != readable.end();
+            due = std::min(due, session->service(now, ready));
+            int fd = session->pollFD();
+            if (fd >= 0)
+            {
+                fds.push_back({ fd, POLLIN, 0 });
+                watched.push_back(session);
+            }
+        }
+        readable.clear();
+
+        guard.unlock();
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count();
+        // round up, waking early would only spin
+        int timeoutMs = (due > Clock::now()) ? static_cast<int>(wait) + 1 : 0;
+        int rc = ::poll(fds.data(), fds.size(), timeoutMs);
+        guard.lock();
+
+        if (rc <= 0)
+            continue;
+        if (fds[0].revents & POLLIN)
+        {
+            char buf[64];
+            while (read(wakeFD, buf, sizeof(buf)) > 0)
+                ;
+        }
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+                readable.push_back(watched[i - 1]);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_REACTOR_H
+#define FOCUSERLINK_REACTOR_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FocuserLinkIO;
+
+// Single I/O thread shared by all FocuserLink devices of the process. It
+// services every registered session and waits with one poll() on the serial
+// ports that have a batch in flight, so N controllers cost one thread.
+class FocuserLinkReactor
+{
+public:
+    static FocuserLinkReactor &instance();
+
+    // thread is started with the first session and stopped after the last
+    bool add(FocuserLinkIO *session);
+    // when this returns the reactor no longer touches session
+    void remove(FocuserLinkIO *session);
+    // services all sessions now, e.g. after new jobs were queued
+    void wake();
+
+    size_t size();
+
+private:
+    FocuserLinkReactor() = default;
+
+    void run();
+
+    std::mutex lock;
+    std::vector<FocuserLinkIO *> sessions;
+    std::thread worker;
+    bool running = false;
+    int wakePipe[2] { -1, -1 };
+    // write end for wake(), which runs without the lock: remove() clears it
+    // and closes the pipe once no wake() is left inside
+    std::atomic<int> wakeWriteFD { -1 };
+    std::atomic<int> waking { 0 };
+};
+
+#endif
@@ -0,0 +1,289 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_SCHEMA_H
+#define FOCUSERLINK_SCHEMA_H
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdint.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "focuserlink_protocol.h"
+
+// fields changed by one settings write and length of a formatted value
+#define SCHEMA_MAX_PATCHES  8
+#define SCHEMA_VALUE_LEN    16
+
+// Reply layouts of the q, u and f records, each field described once with its
+// position, record member and scale. Parsers and the U command formatter are
+// generated from these tables, wrong indices or members fail to compile.
+namespace FocuserLinkSchema
+{
+
+// Decimal digits of a whole number without going through printf, settings
+// writes format every changed field. False when it does not fit into len.
+inline bool formatWhole(unsigned long long magnitude, bool negative, char *out, int len)
+{
+    char digits[24];
+    int n = 0;
+    do
+    {
+        digits[n++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    while (magnitude != 0);
+
+    int total = n + (negative ? 1 : 0);
+    if (total >= len)
+        return false;
+    char *p = out;
+    if (negative)
+        *p++ = '-';
+    while (n > 0)
+        *p++ = digits[--n];
+    *p = '\0';
+    return true;
+}
+
+template <typename T> struct MemberOf;
+template <typename R, typename T> struct MemberOf<T R::*>
+{
+    typedef R Record;
+    typedef T Type;
+};
+
+// Index is the position after the command letter (field 0), Scale the device
+// units per member unit, e.g. 100 for a step size sent in 0.01 um.
+template <auto Member, int Index, int Scale = 1>
+struct Field
+{
+    typedef typename MemberOf<decltype(Member)>::Record Record;
+    typedef typename MemberOf<decltype(Member)>::Type Type;
+    static constexpr int index = Index;
+
+    static_assert(Index > 0 && Index < FOCUSERLINK_MAX_FIELDS, "field index outside of the reply");
+    static_assert(Scale == 1 || std::is_floating_point<Type>::value, "scaled field needs a floating point member");
+
+    template <auto Other>
+    static constexpr bool is()
+    {
+        if constexpr (std::is_same<decltype(Other), decltype(Member)>::value)
+            return Other == Member;
+        else
+            return false;
+    }
+
+    // text at p up to end must be a number the member can hold
+    static bool parse(const char *p, const char **end, Record &record)
+    {
+        char *stop = nullptr;
+        double value = strtod(p, &stop);
+        if (stop == p || !std::isfinite(value))
+            return false;
+        if constexpr (std::is_integral<Type>::value && !std::is_same<Type, bool>::value)
+        {
+            // max + 1 is exact even where max itself rounds up
+            if (value < static_cast<double>(std::numeric_limits<Type>::min()) ||
+                    !(value < static_cast<double>(std::numeric_limits<Type>::max()) + 1.0))
+                return false;
+        }
+        *end = stop;
+        if constexpr (std::is_same<Type, bool>::value)
+            record.*Member = value > 0;
+        else if constexpr (std::is_floating_point<Type>::value)
+            record.*Member = value / Scale;
+        else
+            record.*Member = static_cast<Type>(value);
+        return true;
+    }
+
+    // device stores whole numbers
+    static bool format(Type value, char *out, int len)
+    {
+        if constexpr (std::is_same<Type, bool>::value)
+            return formatWhole(value ? 1 : 0, false, out, len);
+        else if constexpr (std::is_floating_point<Type>::value)
+        {
+            // rounded like %.0f, to nearest with ties to even
+            double whole = std::nearbyint(static_cast<double>(value) * Scale);
+            if (!(std::fabs(whole) < 1e18))
+                return false;
+            return formatWhole(static_cast<unsigned long long>(std::fabs(whole)), whole < 0, out, len);
+        }
+        else if constexpr (std::is_signed<Type>::value)
+        {
+            long long whole = value;
+            return formatWhole(whole < 0 ? 0ull - static_cast<unsigned long long>(whole) : whole, whole < 0, out, len);
+        }
+        else
+            return formatWhole(value, false, out, len);
+    }
+};
+
+template <auto Member, typename... Fields> struct Find
+{
+    typedef void type;
+};
+template <auto Member, typename F, typename... Fields> struct Find<Member, F, Fields...>
+{
+    typedef typename std::conditional<F::template is<Member>(), F, typename Find<Member, Fields...>::type>::type type;
+};
+
+template <int... Indices>
+constexpr bool ascending()
+{
+    const int index[] = { 0, Indices... };
+    for (unsigned i = 1; i < sizeof(index) / sizeof(index[0]); i++)
+    {
+        if (index[i] <= index[i - 1])
+            return false;
+    }
+    return true;
+}
+
+// bit per field with index up to last
+template <int Last, int... Indices>
+constexpr uint32_t fieldsUpTo()
+{
+    const int index[] = { Indices... };
+    uint32_t mask = 0;
+    for (unsigned i = 0; i < sizeof(index) / sizeof(index[0]); i++)
+    {
+        if (index[i] <= Last)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+// Fields up to index Required must be present for a valid reply
+template <char Letter, int Required, typename... Fields>
+struct Layout
+{
+    typedef std::tuple<Fields...> FieldList;
+    static constexpr char letter = Letter;
+    static constexpr uint32_t allFields = (1u << sizeof...(Fields)) - 1;
+    static constexpr uint32_t requiredFields = fieldsUpTo<Required, Fields::index...>();
+
+    static_assert(sizeof...(Fields) <= 32, "too many fields");
+    static_assert(ascending<Fields::index...>(), "field indices must be unique and ascending");
+
+    template <auto Member>
+    using FieldOf = typename Find<Member, Fields...>::type;
+
+    // stores reply field index into the record, marks it in parsed
+    template <typename Record>
+    static void parseField(int index, const char *p, const char **end, Record &record, uint32_t &parsed)
+    {
+        parseAt(index, p, end, record, parsed, std::index_sequence_for<Fields...>());
+    }
+
+private:
+    template <typename Record, size_t... I>
+    static void parseAt(int index, const char *p, const char **end, Record &record, uint32_t &parsed,
+                        std::index_sequence<I...>)
+    {
+        (void)((std::tuple_element<I, FieldList>::type::index == index
+                && (std::tuple_element<I, FieldList>::type::parse(p, end, record) ? (parsed |= 1u << I) : 0, true)) || ...);
+    }
+};
+
+typedef Layout<'q', Q_STEPS_TO_GO,
+        Field<&FocuserLinkProtocol::QRecord::stepperPos, Q_STEPPER_POS>,
+        Field<&FocuserLinkProtocol::QRecord::stepsToGo, Q_STEPS_TO_GO>,
+        Field<&FocuserLinkProtocol::QRecord::sens1Type, Q_SENS1_TYPE>,
+        Field<&FocuserLinkProtocol::QRecord::sens1Temp, Q_SENS1_TEMP>,
+        Field<&FocuserLinkProtocol::QRecord::sens1Hum, Q_SENS1_HUM>,
+        Field<&FocuserLinkProtocol::QRecord::sens1Dew, Q_SENS1_DEW>,
+        Field<&FocuserLinkProtocol::QRecord::compDiff, Q_COMP_DIFF>> QLayout;
+
+typedef Layout<'u', U_COMPAUTO,
+        Field<&FocuserLinkProtocol::URecord::maxPos, U_MAX_POS>,
+        Field<&FocuserLinkProtocol::URecord::reversed, U_REVERSED>,
+        Field<&FocuserLinkProtocol::URecord::stepSize, U_STEPSIZE, 100>,
+        Field<&FocuserLinkProtocol::URecord::compStep, U_COMPSTEP, 100>,
+        Field<&FocuserLinkProtocol::URecord::compCycle, U_COMPCYCLE>,
+        Field<&FocuserLinkProtocol::URecord::compTrigger, U_COMPTRIGGER>,
+        Field<&FocuserLinkProtocol::URecord::compAuto, U_COMPAUTO>> ULayout;
+
+typedef Layout<'f', F_MANUAL,
+        Field<&FocuserLinkProtocol::FRecord::manual, F_MANUAL>> FLayout;
+
+// Walks the reply once and parses the layout fields in place. Returns the
+// number of fields, command letter included, or -1 when the reply is malformed.
+template <typename L, typename Record>
+int parse(const char *res, Record &record, uint32_t &parsed)
+{
+    parsed = 0;
+    if (res == nullptr || res[0] != L::letter)
+        return -1;
+
+    int index = 0;
+    const char *p = res + 1;
+    while (*p == ':')
+    {
+        if (++index >= FOCUSERLINK_MAX_FIELDS)
+            return -1;
+
+        ++p;
+        const char *end = p;
+        uint32_t before = parsed;
+        L::parseField(index, p, &end, record, parsed);
+        while (*end == ' ' || *end == '\r')
+            ++end;
+        if (*end != ':' && *end != '\0')
+        {
+            // not a number, the field counts as missing
+            parsed = before;
+            while (*end != ':' && *end != '\0')
+                ++end;
+        }
+        p = end;
+    }
+    // anything but end of string here means there was no separator after command letter
+    return (*p == '\0') ? index + 1 : -1;
+}
+
+// Settings fields to change with the next U write, values formatted in place
+template <typename L>
+struct Patch
+{
+    int count = 0;
+    int index[SCHEMA_MAX_PATCHES];
+    char value[SCHEMA_MAX_PATCHES][SCHEMA_VALUE_LEN];
+
+    template <auto Member>
+    bool set(typename MemberOf<decltype(Member)>::Type fieldValue)
+    {
+        typedef typename L::template FieldOf<Member> F;
+        static_assert(!std::is_void<F>::value, "member is not a field of this record");
+        if (count == SCHEMA_MAX_PATCHES || !F::format(fieldValue, value[count], SCHEMA_VALUE_LEN))
+            return false;
+        index[count++] = F::index;
+        return true;
+    }
+};
+
+typedef Patch<ULayout> SettingsPatch;
+
+}
+
+#endif
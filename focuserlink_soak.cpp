@@ -0,0 +1,466 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Long running stability test of the serial stack against a misbehaving
+// device. An emulator on a pty injects latency spikes, dropped, corrupted
+// and short replies and dead lines, a FocuserLinkClient polls it through the
+// shared reactor and recovers the way the driver does:
+//   focuserlink_soak [-d hours] [-p poll ms] [-k link delay ms] [-f faults] [-s report s] [-v]
+// Reports missed polls, poll period jitter, memory growth and crash free
+// hours. Exits with 1 when an invariant broke: a value that is not a number
+// reached the client side, a move never ended, the session could not be
+// restarted, polling stalled or memory kept growing.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <poll.h>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+#include "focuserlink_client.h"
+#include "focuserlink_motion.h"
+#include "focuserlink_transport.h"
+
+#define SOAK_DEFAULT_FAULTS     "spike=0.005:3000,drop=0.002,corrupt=0.002,short=0.002,disconnect=0.0002:5000"
+
+// a gap above 1.5 poll periods counts as missed polls
+#define SOAK_MISSED_FACTOR      1.5
+// no position update for this long is a stall [s]
+#define SOAK_STALL              60
+// a move not seen ending within its travel time plus this is stuck [s]
+#define SOAK_MOVE_MARGIN        60
+// time between random moves [s]
+#define SOAK_MOVE_MIN           5
+#define SOAK_MOVE_MAX           30
+// polling must be back this long after a reconnect [s]
+#define SOAK_RESUME             20
+// a reconnect counts as failed when no handshake got through for this long,
+// faults hit them too and an unplugged line needs the fault duration [s]
+#define SOAK_CONNECT_TIME       15
+// resident memory may grow this much after the first report [kB]
+#define SOAK_RSS_LIMIT          8192
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> terminated { false };
+
+static void onSignal(int)
+{
+    terminated = true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-d hours] [-p poll ms] [-k link delay ms] [-f faults] [-s report s] [-v]\n"
+            "  faults default to %s\n", name, SOAK_DEFAULT_FAULTS);
+}
+
+static bool connect(FocuserLinkClient &client)
+{
+    Clock::time_point giveUp = Clock::now() + std::chrono::seconds(SOAK_CONNECT_TIME);
+    while (!terminated)
+    {
+        FocuserLinkClient::ConnectResult rc = client.connect();
+        if (rc == FocuserLinkClient::CONNECT_OK)
+            return true;
+        client.disconnect();
+        if (Clock::now() >= giveUp)
+            break;
+        // a handshake lost to a fault is retried at once, a missing line after a pause
+        if (rc == FocuserLinkClient::CONNECT_OPEN_FAILED)
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    return false;
+}
+
+static double seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// resident set size [kB]
+static long residentKB()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Poll period statistics, gaps of missed polls are counted but not in the jitter
+struct SoakPolls
+{
+    unsigned long updates = 0;
+    unsigned long missed = 0;
+    unsigned long jitterCount = 0;
+    double mean = 0;
+    double m2 = 0;
+    double maxJitter = 0;   // [ms]
+    double maxGap = 0;      // [ms]
+    Clock::time_point last;
+
+    void add(Clock::time_point time, double periodMs)
+    {
+        if (updates++ > 0)
+        {
+            double gap = std::chrono::duration<double, std::milli>(time - last).count();
+            maxGap = std::max(maxGap, gap);
+            if (gap > SOAK_MISSED_FACTOR * periodMs)
+                missed += static_cast<unsigned long>(std::lround(gap / periodMs)) - 1;
+            else
+            {
+                double jitter = gap - periodMs;
+                double delta = jitter - mean;
+                mean += delta / ++jitterCount;
+                m2 += delta * (jitter - mean);
+                maxJitter = std::max(maxJitter, std::fabs(jitter));
+            }
+        }
+        last = time;
+    }
+
+    double stddev() const
+    {
+        return jitterCount > 1 ? std::sqrt(m2 / (jitterCount - 1)) : 0;
+    }
+};
+
+// Values that reach the client side must be numbers, out of range ones are
+// only counted as the device may report anything
+struct SoakValues
+{
+    unsigned long invalid = 0;
+    unsigned long implausible = 0;
+
+    void check(double value, double low, double high)
+    {
+        if (!std::isfinite(value))
+            invalid++;
+        else if (value < low || value > high)
+            implausible++;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    double hours = 1;
+    int pollMs = 200;
+    int linkDelayMs = 2;
+    int reportS = 60;
+    bool verbose = false;
+    FocuserLinkFaults faults;
+    faults.parse(SOAK_DEFAULT_FAULTS);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:p:k:f:s:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                hours = atof(optarg);
+                break;
+            case 'p':
+                pollMs = atoi(optarg);
+                break;
+            case 'k':
+                linkDelayMs = atoi(optarg);
+                break;
+            case 'f':
+                faults = FocuserLinkFaults();
+                if (!faults.parse(optarg))
+                {
+                    fprintf(stderr, "%s: bad fault specification\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                reportS = atoi(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (hours <= 0 || pollMs <= 0 || reportS <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FocuserLinkDeviceConfig config;
+    FocuserLinkPtyTransport line(config);
+    line.emulator().linkDelayMs = linkDelayMs;
+    line.emulator().setFaults(faults);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    // recovery runs in the client, only counted here
+    std::atomic<unsigned long> resyncs { 0 }, linkLost { 0 };
+    FocuserLinkClient client(&line);
+    FocuserLinkClient::Hooks hooks;
+    hooks.recovering = [&resyncs, &linkLost](FocuserLinkClient::Recovery recovery, int)
+    {
+        if (recovery == FocuserLinkClient::RECOVERY_RESYNC)
+            resyncs++;
+        else
+            linkLost++;
+    };
+    client.setHooks(hooks);
+    FocuserLinkIO &session = client.session();
+    session.setPolling(pollMs, pollMs, POLL_ENVIRONMENT, POLL_SETTINGS);
+
+    if (!connect(client))
+    {
+        fprintf(stderr, "cannot connect to the emulator\n");
+        return 1;
+    }
+
+    std::mt19937 random(faults.seed);
+    SoakPolls polls;
+    SoakValues values;
+    unsigned long failedJobs = 0, reconnects = 0, moves = 0, movesDone = 0, movesGivenUp = 0, stuckMoves = 0;
+    bool brokeRestart = false, stalled = false;
+    // polling resumes after each reconnect
+    bool resumePending = false;
+    unsigned long notResumed = 0;
+    double maxResume = 0;
+    Clock::time_point lostAt, reconnectedAt;
+    uint32_t maxPos = 0;
+    int32_t position = -1;
+
+    // move in progress, ends with a q reply showing the motor idle after the last leg started
+    bool moving = false, lastLegStarted = false;
+    Clock::time_point moveDeadline;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(hours * 3600));
+    Clock::time_point nextReport = start + std::chrono::seconds(reportS);
+    Clock::time_point nextMove = start + std::chrono::seconds(SOAK_MOVE_MIN);
+    Clock::time_point lastUpdate = start;
+    long baseRSS = 0, peakGrowth = 0;
+
+    printf("soak %.2f h, poll %d ms, faults spike=%g:%d drop=%g corrupt=%g short=%g disconnect=%g:%d seed=%u\n",
+           hours, pollMs, faults.spikeRate, faults.spikeMs, faults.dropRate, faults.corruptRate, faults.shortRate,
+           faults.disconnectRate, faults.disconnectMs, faults.seed);
+    fflush(stdout);
+
+    while (!terminated.load() && Clock::now() < end && !brokeRestart && !stalled)
+    {
+        struct pollfd pfd = { session.notifyFD(), POLLIN, 0 };
+        poll(&pfd, 1, 50);
+        session.clearNotify();
+
+        Clock::time_point now = Clock::now();
+        FocuserLinkEvent event;
+        bool lost = false;
+        while (!lost && session.nextEvent(event))
+        {
+            switch (event.type)
+            {
+                case FocuserLinkEvent::EVENT_Q:
+                {
+                    const FocuserLinkProtocol::QRecord &q = event.q;
+                    polls.add(event.time, pollMs);
+                    lastUpdate = now;
+                    if (resumePending)
+                    {
+                        resumePending = false;
+                        maxResume = std::max(maxResume, seconds(now - lostAt));
+                    }
+                    position = q.stepperPos;
+                    values.check(q.stepperPos, 0, maxPos > 0 ? maxPos : INT32_MAX);
+                    values.check(event.eta, 0, 24 * 3600);
+                    values.check(event.rate, 0, 1e6);
+                    if (q.hasEnvironment)
+                    {
+                        values.check(q.sens1Temp, -100, 100);
+                        values.check(q.sens1Hum, 0, 100);
+                        values.check(q.sens1Dew, -100, 100);
+                        values.check(q.compDiff, -1e6, 1e6);
+                    }
+                    if (moving && lastLegStarted && q.stepsToGo == 0 && event.plannedSteps == 0)
+                    {
+                        moving = false;
+                        movesDone++;
+                    }
+                    break;
+                }
+                case FocuserLinkEvent::EVENT_U:
+                    maxPos = event.u.maxPos;
+                    values.check(event.u.stepSize, 0, 1e6);
+                    values.check(event.u.compStep, -1e6, 1e6);
+                    values.check(event.u.compCycle, 0, 1e6);
+                    values.check(event.u.compTrigger, 0, 1e6);
+                    break;
+                case FocuserLinkEvent::EVENT_F:
+                    break;
+                case FocuserLinkEvent::EVENT_DONE:
+                    session.complete(event);
+                    break;
+                case FocuserLinkEvent::EVENT_LINK_LOST:
+                    // the restart drops pending events and the move
+                    lost = true;
+                    break;
+                case FocuserLinkEvent::EVENT_FAILED:
+                    failedJobs++;
+                    break;
+                case FocuserLinkEvent::EVENT_SERIAL:
+                    break;
+            }
+        }
+
+        if (lost)
+        {
+            // reopening the line restarts the session and its event queue
+            client.disconnect();
+            if (moving)
+                movesGivenUp++;
+            moving = false;
+            reconnects++;
+            if (verbose)
+                printf("%10.1f s link lost, reconnecting\n", seconds(now - start));
+            lostAt = now;
+            brokeRestart = !connect(client);
+            resumePending = !brokeRestart;
+            reconnectedAt = Clock::now();
+            continue;
+        }
+
+        if (resumePending && seconds(now - reconnectedAt) > SOAK_RESUME)
+        {
+            notResumed++;
+            resumePending = false;
+            printf("%10.1f s no position update %d s after reconnecting\n", seconds(now - start), SOAK_RESUME);
+        }
+
+        if (moving && now > moveDeadline)
+        {
+            stuckMoves++;
+            moving = false;
+            printf("%10.1f s move stuck at %d\n", seconds(now - start), position);
+        }
+        if (!moving && now >= nextMove && maxPos > 0 && position >= 0)
+        {
+            uint32_t target = std::uniform_int_distribution<uint32_t>(0, maxPos)(random);
+            FocuserLinkMotionPlan plan = FocuserLinkMotion::plan(position, target, 0, maxPos);
+            // completions run from session.complete() and are dropped by session.stop()
+            auto done = [&moving, &lastLegStarted, &movesGivenUp](bool ok, const char *)
+            {
+                if (ok)
+                    lastLegStarted = true;
+                else
+                {
+                    moving = false;
+                    movesGivenUp++;
+                }
+            };
+            if (session.submitMove(plan, done))
+            {
+                moves++;
+                moving = true;
+                lastLegStarted = false;
+                double travel = std::abs(static_cast<double>(target) - position) / config.stepRate;
+                moveDeadline = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(travel + SOAK_MOVE_MARGIN));
+                session.expectMotion();
+            }
+            nextMove = now + std::chrono::seconds(std::uniform_int_distribution<int>(SOAK_MOVE_MIN, SOAK_MOVE_MAX)(random));
+        }
+
+        if (seconds(now - lastUpdate) > SOAK_STALL)
+        {
+            stalled = true;
+            printf("%10.1f s no position update for %d s\n", seconds(now - start), SOAK_STALL);
+        }
+
+        if (now >= nextReport)
+        {
+            long rss = residentKB();
+            if (baseRSS == 0)
+                baseRSS = rss;
+            peakGrowth = std::max(peakGrowth, rss - baseRSS);
+            printf("%10.1f s  polls %lu  missed %lu  jitter %.2f/%.2f ms  max gap %.0f ms  "
+                   "resyncs %lu  reconnects %lu  moves %lu/%lu  rss %ld kB (%+ld)\n",
+                   seconds(now - start), polls.updates, polls.missed, polls.mean, polls.stddev(), polls.maxGap,
+                   resyncs.load(), reconnects, movesDone, moves, rss, rss - baseRSS);
+            fflush(stdout);
+            nextReport += std::chrono::seconds(reportS);
+        }
+    }
+
+    double elapsed = seconds(Clock::now() - start);
+    client.disconnect();
+    line.stop();
+
+    const FocuserLinkEmulatorStats &injected = line.emulator().stats();
+    printf("\ncrash free for %.2f h\n", elapsed / 3600);
+    printf("injected: %lu spikes, %lu dropped, %lu corrupted, %lu truncated, %lu disconnects (%lu unplugged, "
+           "%lu commands lost)\n", injected.spikes, injected.dropped, injected.corrupted, injected.truncated,
+           injected.disconnects, injected.unplugs, injected.lost);
+    printf("polls: %lu updates, %lu missed, %lu dropped, jitter mean %.2f ms, stddev %.2f ms, max %.2f ms, max gap %.0f ms\n",
+           polls.updates, polls.missed, session.droppedEvents(), polls.mean, polls.stddev(), polls.maxJitter, polls.maxGap);
+    printf("recovery: %lu resyncs, %lu link lost, %lu reconnects, polling back %.2f s after a lost link at most, %lu failed jobs\n",
+           resyncs.load(), linkLost.load(), reconnects, maxResume, failedJobs);
+    printf("moves: %lu started, %lu done, %lu given up after errors, %lu stuck\n", moves, movesDone, movesGivenUp,
+           stuckMoves);
+    printf("values: %lu not a number, %lu out of range\n", values.invalid, values.implausible);
+    printf("memory: rss %ld kB, grew %ld kB at most after the first report\n", residentKB(), peakGrowth);
+    printf("%-4s %10s %8s %8s %8s %8s %9s %9s\n", "cmd", "count", "timeout", "framing", "error", "discard", "p99 ms",
+           "max ms");
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+    {
+        FocuserLinkStats::Summary summary;
+        client.stats().summary(i, summary);
+        if (summary.count == 0 && summary.discarded == 0)
+            continue;
+        printf("%-4c %10llu %8llu %8llu %8llu %8llu %9.1f %9.1f\n", FocuserLinkStats::commandAt(i),
+               (unsigned long long)summary.count, (unsigned long long)summary.timeouts,
+               (unsigned long long)summary.framing, (unsigned long long)summary.errors,
+               (unsigned long long)summary.discarded, summary.p99, summary.max);
+    }
+
+    bool failed = false;
+    auto broken = [&failed](bool condition, const char *what)
+    {
+        if (condition)
+        {
+            printf("FAILED: %s\n", what);
+            failed = true;
+        }
+    };
+    broken(values.invalid > 0, "values that are not a number reached the client");
+    broken(stuckMoves > 0, "moves did not end");
+    broken(brokeRestart, "session could not be restarted");
+    broken(notResumed > 0, "polling did not resume after a reconnect");
+    broken(stalled, "polling stalled");
+    broken(peakGrowth > SOAK_RSS_LIMIT, "memory kept growing");
+    broken(polls.updates == 0, "no position updates");
+    return failed ? 1 : 0;
+}
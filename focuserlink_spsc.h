@@ -0,0 +1,71 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_SPSC_H
+#define FOCUSERLINK_SPSC_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Capacity is N - 1, N must be a power of two.
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    bool push(const T &item)
+    {
+        size_t head = writeIndex.load(std::memory_order_relaxed);
+        size_t next = (head + 1) & (N - 1);
+        if (next == readIndex.load(std::memory_order_acquire))
+            return false;
+        buffer[head] = item;
+        writeIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        size_t tail = readIndex.load(std::memory_order_relaxed);
+        if (tail == writeIndex.load(std::memory_order_acquire))
+            return false;
+        item = buffer[tail];
+        readIndex.store((tail + 1) & (N - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return readIndex.load(std::memory_order_acquire) == writeIndex.load(std::memory_order_acquire);
+    }
+
+    // consumer side only
+    void clear()
+    {
+        readIndex.store(writeIndex.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T buffer[N];
+    std::atomic<size_t> writeIndex { 0 };
+    std::atomic<size_t> readIndex { 0 };
+};
+
+#endif
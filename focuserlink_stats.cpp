@@ -0,0 +1,147 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+void FocuserLinkStats::record(char command, uint32_t micros, Result result)
+{
+    Entry &entry = entries[indexOf(command)];
+    entry.count.fetch_add(1, std::memory_order_relaxed);
+    switch (result)
+    {
+        case RESULT_OK:
+            break;
+        case RESULT_TIMEOUT:
+            entry.timeouts.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case RESULT_FRAMING:
+            entry.framing.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case RESULT_ERROR:
+            entry.errors.fetch_add(1, std::memory_order_relaxed);
+            break;
+    }
+
+    entry.histogram[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    entry.totalMicros.fetch_add(micros, std::memory_order_relaxed);
+    uint32_t max = entry.maxMicros.load(std::memory_order_relaxed);
+    while (micros > max && !entry.maxMicros.compare_exchange_weak(max, micros, std::memory_order_relaxed))
+        ;
+}
+
+void FocuserLinkStats::recordDiscarded(char command, uint64_t frames)
+{
+    entries[indexOf(command)].discarded.fetch_add(frames, std::memory_order_relaxed);
+}
+
+void FocuserLinkStats::summary(int index, Summary &summary) const
+{
+    const Entry &entry = entries[index];
+    summary.count = entry.count.load(std::memory_order_relaxed);
+    summary.timeouts = entry.timeouts.load(std::memory_order_relaxed);
+    summary.framing = entry.framing.load(std::memory_order_relaxed);
+    summary.errors = entry.errors.load(std::memory_order_relaxed);
+    summary.discarded = entry.discarded.load(std::memory_order_relaxed);
+    summary.totalMicros = entry.totalMicros.load(std::memory_order_relaxed);
+    summary.max = entry.maxMicros.load(std::memory_order_relaxed) / 1000.0;
+
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+        total += entry.histogram[i].load(std::memory_order_relaxed);
+    // bucket limits may overshoot the exact maximum
+    summary.p50 = std::min(percentile(entry.histogram, total, 0.50), summary.max);
+    summary.p99 = std::min(percentile(entry.histogram, total, 0.99), summary.max);
+}
+
+uint64_t FocuserLinkStats::countBelow(int index, uint32_t micros) const
+{
+    uint64_t count = 0;
+    for (int i = 0; i < STATS_BUCKETS && bucketLimit(i) <= micros; i++)
+        count += entries[index].histogram[i].load(std::memory_order_relaxed);
+    return count;
+}
+
+void FocuserLinkStats::reset()
+{
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+    {
+        Entry &entry = entries[i];
+        entry.count = 0;
+        entry.timeouts = 0;
+        entry.framing = 0;
+        entry.errors = 0;
+        entry.discarded = 0;
+        entry.totalMicros = 0;
+        entry.maxMicros = 0;
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            entry.histogram[b] = 0;
+    }
+}
+
+int FocuserLinkStats::indexOf(char command)
+{
+    const char *p = (command != '\0') ? strchr(STATS_COMMANDS, command) : nullptr;
+    return (p != nullptr) ? p - STATS_COMMANDS : STATS_COMMAND_COUNT - 1;
+}
+
+char FocuserLinkStats::commandAt(int index)
+{
+    return (index >= 0 && index < STATS_COMMAND_COUNT - 1) ? STATS_COMMANDS[index] : '?';
+}
+
+int FocuserLinkStats::bucketOf(uint32_t micros)
+{
+    if (micros < 4)
+        return micros;
+    int msb = 31 - __builtin_clz(micros);
+    int sub = (micros >> (msb - 2)) & 3;
+    return (msb - 1) * 4 + sub;
+}
+
+uint32_t FocuserLinkStats::bucketLimit(int bucket)
+{
+    // exclusive upper limit of the bucket
+    bucket++;
+    if (bucket < 4)
+        return bucket;
+    if (bucket >= STATS_BUCKETS)
+        return UINT32_MAX;
+    int msb = bucket / 4 + 1;
+    int sub = bucket % 4;
+    return static_cast<uint32_t>(4 + sub) << (msb - 2);
+}
+
+double FocuserLinkStats::percentile(const std::atomic<uint32_t> *histogram, uint64_t total, double fraction) const
+{
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(fraction * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += histogram[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return bucketLimit(i) / 1000.0;
+    }
+    return bucketLimit(STATS_BUCKETS - 1) / 1000.0;
+}
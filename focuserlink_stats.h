@@ -0,0 +1,98 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_STATS_H
+#define FOCUSERLINK_STATS_H
+
+#include <atomic>
+#include <stdint.h>
+
+// command letters with own statistics, anything else is counted as last entry
+#define STATS_COMMANDS      "#qufFURPHS"
+#define STATS_COMMAND_COUNT 11
+
+// log-linear histogram, 4 buckets per power of two of microseconds
+#define STATS_BUCKETS       124
+
+// Serial round trip statistics per command letter. Recorded by the I/O thread,
+// read from any thread without locking.
+class FocuserLinkStats
+{
+public:
+    enum Result
+    {
+        RESULT_OK,
+        RESULT_TIMEOUT,     // no reply in time
+        RESULT_FRAMING,     // malformed reply: empty, cut short or letter does not match command
+        RESULT_ERROR        // write or read error
+    };
+
+    struct Summary
+    {
+        uint64_t count;
+        uint64_t timeouts;
+        uint64_t framing;
+        uint64_t errors;
+        uint64_t discarded;     // stale or unsolicited frames, not counted as commands
+        uint64_t totalMicros;   // sum of all round trips
+        double p50;         // [ms]
+        double p99;         // [ms]
+        double max;         // [ms]
+    };
+
+    void record(char command, uint32_t micros, Result result);
+    // garbage or unrelated frames seen while waiting for the reply to command
+    void recordDiscarded(char command, uint64_t frames);
+    void summary(int index, Summary &summary) const;
+    // commands of index answered or given up in less than micros, as far as the buckets tell
+    uint64_t countBelow(int index, uint32_t micros) const;
+    void reset();
+
+    // position of command letter in STATS_COMMANDS, unknown letters map to the last entry
+    static int indexOf(char command);
+    static char commandAt(int index);
+
+    // histogram helpers
+    static int bucketOf(uint32_t micros);
+    static uint32_t bucketLimit(int bucket);
+
+private:
+    double percentile(const std::atomic<uint32_t> *histogram, uint64_t total, double fraction) const;
+
+    struct Entry
+    {
+        std::atomic<uint64_t> count { 0 };
+        std::atomic<uint64_t> timeouts { 0 };
+        std::atomic<uint64_t> framing { 0 };
+        std::atomic<uint64_t> errors { 0 };
+        std::atomic<uint64_t> discarded { 0 };
+        std::atomic<uint64_t> totalMicros { 0 };
+        std::atomic<uint32_t> maxMicros { 0 };
+        std::atomic<uint32_t> histogram[STATS_BUCKETS];
+
+        Entry()
+        {
+            for (int i = 0; i < STATS_BUCKETS; i++)
+                histogram[i] = 0;
+        }
+    };
+
+    Entry entries[STATS_COMMAND_COUNT];
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_telemetry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FocuserLinkTelemetry::FocuserLinkTelemetry() : memory(TELEMETRY_CAPACITY)
+{
+    memoryHeader.magic = TELEMETRY_MAGIC;
+    memoryHeader.version = TELEMETRY_VERSION;
+    memoryHeader.capacity = TELEMETRY_CAPACITY;
+    memoryHeader.sampleSize = sizeof(FocuserLinkSample);
+    memoryHeader.written = 0;
+    header = &memoryHeader;
+    samples = memory.data();
+}
+
+FocuserLinkTelemetry::~FocuserLinkTelemetry()
+{
+    closeLog();
+}
+
+bool FocuserLinkTelemetry::openLog(const char *path)
+{
+    closeLog();
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        savedErrno = errno;
+        return false;
+    }
+
+    size_t size = sizeof(Header) + TELEMETRY_CAPACITY * sizeof(FocuserLinkSample);
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size;
+    if (!valid && ftruncate(fd, size) != 0)
+    {
+        savedErrno = errno;
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        savedErrno = errno;
+        return false;
+    }
+
+    Header *fileHeader = static_cast<Header *>(map);
+    if (!valid || fileHeader->magic != TELEMETRY_MAGIC || fileHeader->version != TELEMETRY_VERSION
+            || fileHeader->capacity != TELEMETRY_CAPACITY || fileHeader->sampleSize != sizeof(FocuserLinkSample))
+    {
+        // foreign or older layout, start over
+        *fileHeader = memoryHeader;
+        fileHeader->written = 0;
+    }
+
+    // carry over what was recorded before the log was opened
+    FocuserLinkSample *fileSamples = reinterpret_cast<FocuserLinkSample *>(fileHeader + 1);
+    int64_t last = (fileHeader->written > 0) ? fileSamples[(fileHeader->written - 1) % TELEMETRY_CAPACITY].timeMs : INT64_MIN;
+    uint64_t first = (header->written > TELEMETRY_CAPACITY) ? header->written - TELEMETRY_CAPACITY : 0;
+    for (uint64_t i = first; i < header->written; i++)
+    {
+        if (at(i).timeMs > last)
+            fileSamples[fileHeader->written++ % TELEMETRY_CAPACITY] = at(i);
+    }
+
+    mapped = map;
+    mappedSize = size;
+    header = fileHeader;
+    samples = fileSamples;
+    return true;
+}
+
+void FocuserLinkTelemetry::closeLog()
+{
+    if (mapped == nullptr)
+        return;
+
+    // keep the history in memory
+    memoryHeader.written = header->written;
+    memcpy(memory.data(), samples, TELEMETRY_CAPACITY * sizeof(FocuserLinkSample));
+    header = &memoryHeader;
+    samples = memory.data();
+
+    munmap(mapped, mappedSize);
+    mapped = nullptr;
+    mappedSize = 0;
+}
+
+void FocuserLinkTelemetry::record(const FocuserLinkSample &sample)
+{
+    samples[header->written % TELEMETRY_CAPACITY] = sample;
+    header->written++;
+}
+
+size_t FocuserLinkTelemetry::size() const
+{
+    return std::min<uint64_t>(header->written, TELEMETRY_CAPACITY);
+}
+
+size_t FocuserLinkTelemetry::exportCsv(int64_t fromMs, int64_t toMs, std::string &csv) const
+{
+    csv = "time,position,steps_to_go,temperature,humidity,dew_point,comp_diff\n";
+
+    uint64_t first = header->written - size();
+    size_t rows = 0;
+    char line[160];
+    for (uint64_t i = first; i < header->written; i++)
+    {
+        const FocuserLinkSample &sample = at(i);
+        if (sample.timeMs < fromMs || sample.timeMs > toMs)
+            continue;
+
+        time_t seconds = sample.timeMs / 1000;
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+
+        if (std::isnan(sample.temperature))
+            snprintf(line, sizeof(line), "%s.%03dZ,%d,%d,,,,%d\n", stamp, static_cast<int>(sample.timeMs % 1000),
+                     sample.position, sample.stepsToGo, sample.compDiff);
+        else
+            snprintf(line, sizeof(line), "%s.%03dZ,%d,%d,%.2f,%.1f,%.2f,%d\n", stamp, static_cast<int>(sample.timeMs % 1000),
+                     sample.position, sample.stepsToGo, sample.temperature, sample.humidity, sample.dewPoint, sample.compDiff);
+        csv += line;
+        rows++;
+    }
+    return rows;
+}
+
+int64_t FocuserLinkTelemetry::nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,104 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_TELEMETRY_H
+#define FOCUSERLINK_TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// samples kept per device, every position poll is one: 36 hours at the
+// default 2000 ms idle poll, 55 minutes of motion at the 50 ms moving poll.
+// The ring takes 2 MB per device (32 MB for 16 FOCUSERLINK_UNITS), in memory
+// and in the mapped log
+#define TELEMETRY_CAPACITY  65536
+
+#define TELEMETRY_MAGIC     0x4b4c4654
+#define TELEMETRY_VERSION   1
+
+// One poll worth of focuser and environment data, 32 bytes
+struct FocuserLinkSample
+{
+    int64_t timeMs;         // [ms] since the epoch
+    int32_t position;
+    int32_t stepsToGo;
+    int32_t compDiff;       // [steps]
+    float temperature;      // [C], NaN without sensor
+    float humidity;         // [%]
+    float dewPoint;         // [C]
+};
+
+// Fixed size history of poll samples. The ring can be mirrored to a memory
+// mapped file, so it survives driver restarts. Recording does not allocate
+// and makes no system calls, the kernel writes the mapped pages back.
+class FocuserLinkTelemetry
+{
+public:
+    FocuserLinkTelemetry();
+    ~FocuserLinkTelemetry();
+
+    // samples already in the file are kept, newer ones from memory are appended
+    bool openLog(const char *path);
+    void closeLog();
+    bool logging() const
+    {
+        return mapped != nullptr;
+    }
+    int lastErrno() const
+    {
+        return savedErrno;
+    }
+
+    void record(const FocuserLinkSample &sample);
+
+    size_t size() const;
+    // CSV rows for fromMs <= time <= toMs, returns the number of rows
+    size_t exportCsv(int64_t fromMs, int64_t toMs, std::string &csv) const;
+
+    static int64_t nowMs();
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t sampleSize;
+        uint64_t written;
+    };
+
+    const FocuserLinkSample &at(uint64_t index) const
+    {
+        return samples[index % TELEMETRY_CAPACITY];
+    }
+
+    // either the in-memory ring or the mapped file
+    Header *header;
+    FocuserLinkSample *samples;
+
+    Header memoryHeader;
+    std::vector<FocuserLinkSample> memory;
+
+    void *mapped = nullptr;
+    size_t mappedSize = 0;
+    int savedErrno = 0;
+};
+
+#endif
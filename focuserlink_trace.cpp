@@ -0,0 +1,132 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static_assert((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0, "TRACE_CAPACITY must be a power of two");
+
+// slot sequence while it is being written
+#define TRACE_WRITING   UINT64_MAX
+
+FocuserLinkTrace::FocuserLinkTrace() : started(Clock::now())
+{
+    for (Slot &slot : slots)
+    {
+        slot.sequence.store(TRACE_WRITING, std::memory_order_relaxed);
+        slot.stamp.store(0, std::memory_order_relaxed);
+        slot.payload.store(0, std::memory_order_relaxed);
+    }
+}
+
+void FocuserLinkTrace::record(FocuserLinkTraceEntry::Type type, char letter, uint8_t code, int32_t arg, size_t sent,
+                              size_t received)
+{
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+    uint64_t stamp = (micros & 0xffffffffffffULL) | static_cast<uint64_t>(std::min<size_t>(sent, 255)) << 48 |
+                     static_cast<uint64_t>(std::min<size_t>(received, 255)) << 56;
+    uint64_t payload = static_cast<uint32_t>(arg) | static_cast<uint64_t>(type) << 32 |
+                       static_cast<uint64_t>(static_cast<uint8_t>(letter)) << 40 | static_cast<uint64_t>(code) << 48;
+
+    uint64_t sequence = head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slots[sequence & (TRACE_CAPACITY - 1)];
+    slot.sequence.store(TRACE_WRITING, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.stamp.store(stamp, std::memory_order_relaxed);
+    slot.payload.store(payload, std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_release);
+}
+
+bool FocuserLinkTrace::read(uint64_t sequence, FocuserLinkTraceEntry &entry) const
+{
+    const Slot &slot = slots[sequence & (TRACE_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != sequence)
+        return false;
+    uint64_t stamp = slot.stamp.load(std::memory_order_relaxed);
+    uint64_t payload = slot.payload.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten while copying
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+        return false;
+
+    entry.sequence = sequence;
+    entry.timeUs = stamp & 0xffffffffffffULL;
+    entry.sent = (stamp >> 48) & 0xff;
+    entry.received = (stamp >> 56) & 0xff;
+    entry.arg = static_cast<int32_t>(payload & 0xffffffff);
+    entry.type = (payload >> 32) & 0xff;
+    entry.letter = static_cast<char>((payload >> 40) & 0xff);
+    entry.code = (payload >> 48) & 0xff;
+    return true;
+}
+
+size_t FocuserLinkTrace::dump(std::string &text, size_t count) const
+{
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end - std::min<uint64_t>(end, std::min<size_t>(count, TRACE_CAPACITY));
+
+    text.clear();
+    size_t lines = 0;
+    char line[128];
+    for (uint64_t sequence = begin; sequence < end; sequence++)
+    {
+        FocuserLinkTraceEntry entry;
+        if (!read(sequence, entry))
+            continue;
+        format(entry, line, sizeof(line));
+        text += line;
+        text += '\n';
+        lines++;
+    }
+    return lines;
+}
+
+void FocuserLinkTrace::format(const FocuserLinkTraceEntry &entry, char *line, size_t len)
+{
+    static const char *results[] = { "ok", "timeout", "error" };
+    static const char *states[] = { "Idle", "Ok", "Busy", "Alert" };
+    char letter = (entry.letter >= ' ' && entry.letter < 127) ? entry.letter : '?';
+    int n = snprintf(line, len, "%8llu %12.6f ", static_cast<unsigned long long>(entry.sequence), entry.timeUs / 1e6);
+    if (n < 0 || static_cast<size_t>(n) >= len)
+        return;
+    line += n;
+    len -= n;
+
+    switch (entry.type)
+    {
+        case FocuserLinkTraceEntry::TRACE_EXCHANGE:
+            snprintf(line, len, "exchange %c %s out %u in %u %d us", letter, results[std::min<int>(entry.code, 2)],
+                     entry.sent, entry.received, entry.arg);
+            break;
+        case FocuserLinkTraceEntry::TRACE_DISCARD:
+            snprintf(line, len, "discard  %c %d stale frames", letter, entry.arg);
+            break;
+        case FocuserLinkTraceEntry::TRACE_MOVE:
+            snprintf(line, len, "move     to %d in %u legs", entry.arg, entry.code);
+            break;
+        case FocuserLinkTraceEntry::TRACE_STATE:
+            snprintf(line, len, "state    %c %s at %d", letter, states[std::min<int>(entry.code, 3)], entry.arg);
+            break;
+        case FocuserLinkTraceEntry::TRACE_LINK:
+            snprintf(line, len, "link     %s after %d failures", entry.code ? "lost" : "resync", entry.arg);
+            break;
+        default:
+            snprintf(line, len, "unknown  %u", entry.type);
+    }
+}
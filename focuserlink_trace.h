@@ -0,0 +1,93 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_TRACE_H
+#define FOCUSERLINK_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+// entries kept, power of two
+#define TRACE_CAPACITY      4096
+
+// One decoded trace entry
+struct FocuserLinkTraceEntry
+{
+    enum Type
+    {
+        TRACE_EXCHANGE,     // letter, code port result, sent/received bytes, arg round trip [us]
+        TRACE_DISCARD,      // letter waited for, arg stale frames skipped
+        TRACE_MOVE,         // arg target position, code number of legs
+        TRACE_STATE,        // letter property tag, code new IPState, arg position
+        TRACE_LINK          // code 0 resync, 1 link lost, arg consecutive failures
+    };
+
+    uint64_t sequence;
+    uint64_t timeUs;        // since the trace was created
+    int32_t arg;
+    uint8_t type;
+    char letter;
+    uint8_t code;
+    uint8_t sent;
+    uint8_t received;
+};
+
+// Always on binary trace of serial and state events. Recording is a few
+// relaxed atomic stores into a fixed ring, safe from any number of threads,
+// no formatting and no locks. Readers take a consistent snapshot by checking
+// each slot's sequence number before and after copying it.
+class FocuserLinkTrace
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    FocuserLinkTrace();
+
+    void record(FocuserLinkTraceEntry::Type type, char letter, uint8_t code, int32_t arg, size_t sent = 0,
+                size_t received = 0);
+
+    // entries recorded so far, including overwritten ones
+    uint64_t recorded() const
+    {
+        return head.load(std::memory_order_relaxed);
+    }
+
+    // last count entries as text, one line each, returns the number of lines
+    size_t dump(std::string &text, size_t count = TRACE_CAPACITY) const;
+    static void format(const FocuserLinkTraceEntry &entry, char *line, size_t len);
+
+private:
+    // stamp: time [us] in the low 48 bits, sent and received bytes above
+    // payload: arg in the low 32 bits, then type, letter and code
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> stamp;
+        std::atomic<uint64_t> payload;
+    };
+
+    bool read(uint64_t sequence, FocuserLinkTraceEntry &entry) const;
+
+    Clock::time_point started;
+    std::atomic<uint64_t> head { 0 };
+    Slot slots[TRACE_CAPACITY];
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_transcript.h"
+
+#include <cstring>
+
+struct TranscriptHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    int64_t startMs;
+};
+
+// fixed part of a record, command and reply text follow
+struct TranscriptRecord
+{
+    uint64_t timeUs;
+    uint32_t roundTripUs;
+    uint8_t result;
+    uint8_t commandLen;
+    uint8_t replyLen;
+} __attribute__((packed));
+
+FocuserLinkTranscriptWriter::~FocuserLinkTranscriptWriter()
+{
+    close();
+}
+
+bool FocuserLinkTranscriptWriter::open(const char *path)
+{
+    close();
+
+    std::lock_guard<std::mutex> guard(lock);
+    file = fopen(path, "wb");
+    if (file == nullptr)
+        return false;
+
+    TranscriptHeader header = { TRANSCRIPT_MAGIC, TRANSCRIPT_VERSION, 0, 0 };
+    header.startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()).count();
+    started = Clock::now();
+    count = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void FocuserLinkTranscriptWriter::close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (file != nullptr)
+        fclose(file);
+    file = nullptr;
+}
+
+void FocuserLinkTranscriptWriter::record(const char *command, const char *reply, Clock::time_point sent,
+        uint32_t roundTripUs, FocuserLinkExchange::Result result)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (file == nullptr)
+        return;
+
+    char buf[sizeof(TranscriptRecord) + 2 * ASTROLINK4_LEN];
+    TranscriptRecord record;
+    record.timeUs = (sent > started) ? std::chrono::duration_cast<std::chrono::microseconds>(sent - started).count() : 0;
+    record.roundTripUs = roundTripUs;
+    record.result = result;
+    record.commandLen = strnlen(command, ASTROLINK4_LEN - 1);
+    record.replyLen = (reply != nullptr) ? strnlen(reply, ASTROLINK4_LEN - 1) : 0;
+
+    memcpy(buf, &record, sizeof(record));
+    memcpy(buf + sizeof(record), command, record.commandLen);
+    if (record.replyLen > 0)
+        memcpy(buf + sizeof(record) + record.commandLen, reply, record.replyLen);
+    // buffered, one call keeps the record whole
+    fwrite(buf, sizeof(record) + record.commandLen + record.replyLen, 1, file);
+    count++;
+}
+
+bool FocuserLinkReplay::load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+
+    TranscriptHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRANSCRIPT_MAGIC
+            || header.version != TRANSCRIPT_VERSION)
+    {
+        fclose(file);
+        return false;
+    }
+    startMs = header.startMs;
+
+    exchanges.clear();
+    for (int i = 0; i < 128; i++)
+        byLetter[i].clear();
+
+    TranscriptRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        FocuserLinkExchange exchange;
+        if (record.commandLen == 0 || record.commandLen >= ASTROLINK4_LEN || record.replyLen >= ASTROLINK4_LEN
+                || fread(exchange.command, record.commandLen, 1, file) != 1
+                || (record.replyLen > 0 && fread(exchange.reply, record.replyLen, 1, file) != 1))
+            break;  // truncated by a crash, keep what is complete
+        exchange.command[record.commandLen] = '\0';
+        exchange.reply[record.replyLen] = '\0';
+        exchange.timeUs = record.timeUs;
+        exchange.roundTripUs = record.roundTripUs;
+        exchange.result = record.result;
+        byLetter[exchange.command[0] & 0x7F].push_back(exchanges.size());
+        exchanges.push_back(exchange);
+    }
+    fclose(file);
+    rewind();
+    return true;
+}
+
+const FocuserLinkExchange *FocuserLinkReplay::next(const char *command)
+{
+    int letter = command[0] & 0x7F;
+    if (cursor[letter] >= byLetter[letter].size())
+        return nullptr;
+    return &exchanges[byLetter[letter][cursor[letter]++]];
+}
+
+void FocuserLinkReplay::rewind()
+{
+    for (int i = 0; i < 128; i++)
+        cursor[i] = 0;
+}
+
+size_t FocuserLinkReplay::remaining(char letter) const
+{
+    return byLetter[letter & 0x7F].size() - cursor[letter & 0x7F];
+}
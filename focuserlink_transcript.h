@@ -0,0 +1,113 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_TRANSCRIPT_H
+#define FOCUSERLINK_TRANSCRIPT_H
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "focuserlink_protocol.h"
+
+#define TRANSCRIPT_MAGIC    0x52544c46
+#define TRANSCRIPT_VERSION  1
+
+// One serial exchange as recorded
+struct FocuserLinkExchange
+{
+    enum Result
+    {
+        EXCHANGE_OK, EXCHANGE_TIMEOUT, EXCHANGE_ERROR
+    };
+
+    uint64_t timeUs;        // command sent, since start of the recording
+    uint32_t roundTripUs;
+    uint8_t result;
+    char command[ASTROLINK4_LEN];
+    char reply[ASTROLINK4_LEN];
+};
+
+// Binary transcript of serial exchanges. A 16 byte header (magic, version,
+// wall clock start in ms) is followed by one record per exchange: time and
+// round trip, result, command and reply length, then the text of both.
+// Records are written from the INDI thread and the reactor, a lock keeps them whole.
+class FocuserLinkTranscriptWriter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    ~FocuserLinkTranscriptWriter();
+
+    bool open(const char *path);
+    void close();
+    bool isOpen() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return file != nullptr;
+    }
+
+    void record(const char *command, const char *reply, Clock::time_point sent, uint32_t roundTripUs,
+                FocuserLinkExchange::Result result);
+
+    unsigned long records() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return count;
+    }
+
+private:
+    mutable std::mutex lock;
+    FILE *file = nullptr;
+    Clock::time_point started;
+    unsigned long count = 0;
+};
+
+// Recorded exchanges served back in order. Each command letter has its own
+// cursor, so replies stay in recorded order even when the driver polls at
+// another cadence than during the recording.
+class FocuserLinkReplay
+{
+public:
+    bool load(const char *path);
+
+    // next recorded exchange for the letter of command, nullptr when used up
+    const FocuserLinkExchange *next(const char *command);
+    void rewind();
+
+    size_t size() const
+    {
+        return exchanges.size();
+    }
+    // exchanges of letter not served yet
+    size_t remaining(char letter) const;
+    int64_t startTimeMs() const
+    {
+        return startMs;
+    }
+
+private:
+    std::vector<FocuserLinkExchange> exchanges;
+    std::vector<uint32_t> byLetter[128];
+    size_t cursor[128] = {};
+    int64_t startMs = 0;
+};
+
+#endif
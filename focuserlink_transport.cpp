@@ -0,0 +1,173 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "focuserlink_transport.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t speedOf(int baud)
+{
+    switch (baud)
+    {
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        case 230400:
+            return B230400;
+        default:
+            return B38400;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Serial port
+//////////////////////////////////////////////////////////////////////
+FocuserLinkSerialTransport::~FocuserLinkSerialTransport()
+{
+    close();
+}
+
+void FocuserLinkSerialTransport::adopt(int fd)
+{
+    close();
+    portFD = fd;
+    owned = false;
+}
+
+bool FocuserLinkSerialTransport::open()
+{
+    if (isOpen())
+        return true;
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return false;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    // reads are timed by poll() in FocuserLinkPort
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speedOf(baud));
+    cfsetospeed(&tio, speedOf(baud));
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return false;
+    }
+    portFD = fd;
+    owned = true;
+    return true;
+}
+
+void FocuserLinkSerialTransport::close()
+{
+    if (portFD >= 0 && owned)
+        ::close(portFD);
+    portFD = -1;
+    owned = false;
+}
+
+void FocuserLinkSerialTransport::flush()
+{
+    if (portFD >= 0)
+        tcflush(portFD, TCIOFLUSH);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Pseudo terminal
+//////////////////////////////////////////////////////////////////////
+FocuserLinkPtyTransport::~FocuserLinkPtyTransport()
+{
+    close();
+    stop();
+}
+
+void FocuserLinkPtyTransport::stop()
+{
+    stopping = true;
+    if (server.joinable())
+        server.join();
+}
+
+bool FocuserLinkPtyTransport::open()
+{
+    if (isOpen())
+        return true;
+    // the emulator is started with the first open and kept until stop()
+    if (!server.joinable())
+    {
+        if (stopping.load() || !device.open())
+            return false;
+        server = std::thread([this]()
+        {
+            device.run(stopping);
+        });
+    }
+
+    int fd = ::open(device.slaveName().c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return false;
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    lineFD = fd;
+    return true;
+}
+
+void FocuserLinkPtyTransport::close()
+{
+    if (lineFD >= 0)
+        ::close(lineFD);
+    lineFD = -1;
+}
+
+void FocuserLinkPtyTransport::flush()
+{
+    if (lineFD >= 0)
+        tcflush(lineFD, TCIOFLUSH);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// In process
+//////////////////////////////////////////////////////////////////////
+bool FocuserLinkMemoryTransport::exchange(const char *cmd, char *res)
+{
+    if (!opened)
+        return false;
+    model.handle(cmd, res, ASTROLINK4_LEN);
+    return true;
+}
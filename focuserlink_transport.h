@@ -0,0 +1,157 @@
+/*******************************************************************************
+ Copyright(c) 2022 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FOCUSERLINK_TRANSPORT_H
+#define FOCUSERLINK_TRANSPORT_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "focuserlink_device.h"
+#include "focuserlink_emulator.h"
+
+#define TRANSPORT_DEFAULT_BAUD  38400
+
+// Line to a FocuserLink controller. Transports with a file descriptor are
+// driven by FocuserLinkPort and can be pipelined on the shared reactor, the
+// others answer each command in the calling thread.
+class FocuserLinkTransport
+{
+public:
+    virtual ~FocuserLinkTransport() = default;
+
+    // returns false with errno set on failure
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    // descriptor for FocuserLinkPort, -1 when commands are answered in process
+    virtual int fd() const
+    {
+        return -1;
+    }
+    // in process exchange, only used when fd() is -1
+    virtual bool exchange(const char *cmd, char *res)
+    {
+        (void)cmd;
+        (void)res;
+        return false;
+    }
+    // drops anything in flight on the line
+    virtual void flush() {}
+};
+
+// Serial port, raw 8N1
+class FocuserLinkSerialTransport : public FocuserLinkTransport
+{
+public:
+    explicit FocuserLinkSerialTransport(const char *path = "", int baud = TRANSPORT_DEFAULT_BAUD) : path(path), baud(baud) {}
+    ~FocuserLinkSerialTransport();
+
+    // uses a port opened and configured elsewhere, e.g. by the INDI serial
+    // connection, close() then leaves it open
+    void adopt(int fd);
+
+    bool open() override;
+    void close() override;
+    bool isOpen() const override
+    {
+        return portFD >= 0;
+    }
+    int fd() const override
+    {
+        return portFD;
+    }
+    void flush() override;
+
+private:
+    std::string path;
+    int baud;
+    int portFD = -1;
+    bool owned = false;
+};
+
+// Emulated controller on a pseudo terminal, served by its own thread. The
+// whole serial path is exercised without hardware, the device keeps running
+// while the line is closed and opened again.
+class FocuserLinkPtyTransport : public FocuserLinkTransport
+{
+public:
+    explicit FocuserLinkPtyTransport(const FocuserLinkDeviceConfig &config = FocuserLinkDeviceConfig()) : device(config) {}
+    ~FocuserLinkPtyTransport();
+
+    // set latency, faults etc. before the first open(), statistics are
+    // complete once the transport is destroyed or stop() returned
+    FocuserLinkEmulator &emulator()
+    {
+        return device;
+    }
+    void stop();
+
+    bool open() override;
+    void close() override;
+    bool isOpen() const override
+    {
+        return lineFD >= 0;
+    }
+    int fd() const override
+    {
+        return lineFD;
+    }
+    void flush() override;
+
+private:
+    FocuserLinkEmulator device;
+    std::thread server;
+    std::atomic<bool> stopping { false };
+    int lineFD = -1;
+};
+
+// Device model answering in the calling thread, no line at all
+class FocuserLinkMemoryTransport : public FocuserLinkTransport
+{
+public:
+    explicit FocuserLinkMemoryTransport(const FocuserLinkDeviceConfig &config = FocuserLinkDeviceConfig()) : model(config) {}
+
+    FocuserLinkDevice &device()
+    {
+        return model;
+    }
+
+    bool open() override
+    {
+        opened = true;
+        return true;
+    }
+    void close() override
+    {
+        opened = false;
+    }
+    bool isOpen() const override
+    {
+        return opened;
+    }
+    bool exchange(const char *cmd, char *res) override;
+
+private:
+    FocuserLinkDevice model;
+    bool opened = false;
+};
+
+#endif
@@ -22,47 +22,133 @@
 #define VERSION_MAJOR 0
 #define VERSION_MINOR 2
 
-#define ASTROLINK4_LEN 100
-#define ASTROLINK4_TIMEOUT 3
+// trace entries written to the log on errors, and the minimum time between such dumps [s]
+#define TRACE_ERROR_ENTRIES 24
+#define TRACE_ERROR_HOLDOFF 60
 
-#define POLLTIME 500
+#define PUBLISH_STATS_PERIOD 10
+
+// fitted slope is only applied when it differs more from the current one [steps/C]
+#define COMP_APPLY_DELTA 0.5
+
+static FocuserLinkExchange::Result exchangeResult(FocuserLinkPort::Result rc)
+{
+    switch (rc)
+    {
+        case FocuserLinkPort::PORT_OK:
+            return FocuserLinkExchange::EXCHANGE_OK;
+        case FocuserLinkPort::PORT_TIMEOUT:
+            return FocuserLinkExchange::EXCHANGE_TIMEOUT;
+        default:
+            return FocuserLinkExchange::EXCHANGE_ERROR;
+    }
+}
 
 //////////////////////////////////////////////////////////////////////
 /// Delegates
 //////////////////////////////////////////////////////////////////////
-std::unique_ptr<FocuserLink> indiFocuserLink(new FocuserLink());
+// One process hosts up to FOCUSERLINK_MAX_UNITS controllers, all sharing one
+// I/O reactor. FOCUSERLINK_PORTS="/dev/ttyACM0,/dev/ttyACM1" creates a device
+// per port, FOCUSERLINK_UNITS=N creates N devices with the default port.
+static std::vector<std::unique_ptr<FocuserLink>> units;
+
+static void ISInit()
+{
+    static bool isInit = false;
+    if (isInit)
+        return;
+    isInit = true;
+
+    std::vector<std::string> ports;
+    const char *portList = getenv("FOCUSERLINK_PORTS");
+    if (portList != nullptr)
+    {
+        std::stringstream list(portList);
+        std::string port;
+        while (std::getline(list, port, ',') && ports.size() < FOCUSERLINK_MAX_UNITS)
+        {
+            if (!port.empty())
+                ports.push_back(port);
+        }
+    }
+
+    int count = ports.size();
+    const char *unitCount = getenv("FOCUSERLINK_UNITS");
+    if (count == 0 && unitCount != nullptr)
+        count = std::min(std::max(atoi(unitCount), 1), FOCUSERLINK_MAX_UNITS);
+    count = std::max(count, 1);
+
+    for (int i = 0; i < count; i++)
+        units.emplace_back(new FocuserLink(i, (i < static_cast<int>(ports.size())) ? ports[i].c_str() : nullptr));
+}
 
 void ISGetProperties(const char *dev)
 {
-    indiFocuserLink->ISGetProperties(dev);
+    ISInit();
+    for (auto &unit : units)
+    {
+        if (dev == nullptr || !strcmp(dev, unit->getDeviceName()))
+            unit->ISGetProperties(dev);
+    }
 }
 void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
 {
-    indiFocuserLink->ISNewSwitch(dev, name, states, names, num);
+    ISInit();
+    for (auto &unit : units)
+    {
+        if (dev == nullptr || !strcmp(dev, unit->getDeviceName()))
+            unit->ISNewSwitch(dev, name, states, names, num);
+    }
 }
 void ISNewText(const char *dev, const char *name, char *texts[], char *names[], int num)
 {
-    indiFocuserLink->ISNewText(dev, name, texts, names, num);
+    ISInit();
+    for (auto &unit : units)
+    {
+        if (dev == nullptr || !strcmp(dev, unit->getDeviceName()))
+            unit->ISNewText(dev, name, texts, names, num);
+    }
 }
 void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
 {
-    indiFocuserLink->ISNewNumber(dev, name, values, names, num);
+    ISInit();
+    for (auto &unit : units)
+    {
+        if (dev == nullptr || !strcmp(dev, unit->getDeviceName()))
+            unit->ISNewNumber(dev, name, values, names, num);
+    }
 }
 void ISNewBLOB(const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int num)
 {
-    indiFocuserLink->ISNewBLOB(dev, name, sizes, blobsizes, blobs, formats, names, num);
+    ISInit();
+    for (auto &unit : units)
+    {
+        if (dev == nullptr || !strcmp(dev, unit->getDeviceName()))
+            unit->ISNewBLOB(dev, name, sizes, blobsizes, blobs, formats, names, num);
+    }
 }
 void ISSnoopDevice(XMLEle *root)
 {
-    indiFocuserLink->ISSnoopDevice(root);
+    ISInit();
+    for (auto &unit : units)
+        unit->ISSnoopDevice(root);
 }
 
 //////////////////////////////////////////////////////////////////////
 ///Constructor
 //////////////////////////////////////////////////////////////////////
-FocuserLink::FocuserLink() : FI(this), WI(this)
+FocuserLink::FocuserLink(int unit, const char *defaultPort) : FI(this), WI(this),
+    defaultPort(defaultPort ? defaultPort : "/dev/ttyUSB0")
 {
     setVersion(VERSION_MAJOR, VERSION_MINOR);
+    setClientHooks();
+    // first unit keeps the plain name, so single controller setups are unchanged
+    if (unit > 0)
+    {
+        char name[MAXINDIDEVICE];
+        snprintf(name, MAXINDIDEVICE, "%s %d", getDefaultName(), unit + 1);
+        setDeviceName(name);
+    }
 }
 
 const char *FocuserLink::getDefaultName()
@@ -76,31 +162,102 @@ const char *FocuserLink::getDefaultName()
 bool FocuserLink::Handshake()
 {
     PortFD = serialConnection->getPortFD();
+    serialLine.adopt(PortFD);
+    client.setTransport(isSimulation() ? static_cast<FocuserLinkTransport *>(&simulatedLine) : &serialLine);
 
-    char res[ASTROLINK4_LEN] = {0};
-    if (sendCommand("#", res))
+    io.setPolling(PollingN[PI_MOVING].value, PollingN[PI_IDLE].value, PollingN[PI_ENVIRONMENT].value,
+                  PollingN[PI_SETTINGS].value);
+    switch (client.connect())
     {
-        if (strncmp(res, "#:FocuserLink", 12) != 0)
-        {
+        case FocuserLinkClient::CONNECT_OK:
+            // a client connecting by hand ends a pending reconnect
+            if (reconnectTimerID >= 0)
+            {
+                IERmTimer(reconnectTimerID);
+                reconnectTimerID = -1;
+            }
+            // from now on the port is owned by the I/O worker
+            ioCallbackID = IEAddCallback(io.notifyFD(), ioCallback, this);
+            publishCachedSettings();
+            return true;
+        case FocuserLinkClient::CONNECT_UNKNOWN_DEVICE:
             LOG_ERROR("Device not recognized.");
             return false;
-        }
-        else
-        {
-            SetTimer(POLLTIME);
-            return true;
-        }
+        case FocuserLinkClient::CONNECT_NO_SESSION:
+            LOG_ERROR("Cannot start serial I/O thread.");
+            return false;
+        default:
+            return false;
     }
-    return false;
 }
 
-void FocuserLink::TimerHit()
+bool FocuserLink::Disconnect()
+{
+    if (reconnectTimerID >= 0)
+    {
+        IERmTimer(reconnectTimerID);
+        reconnectTimerID = -1;
+    }
+    if (ioCallbackID >= 0)
+    {
+        IERmCallback(ioCallbackID);
+        ioCallbackID = -1;
+    }
+    client.disconnect();
+    if (estimateTimerID >= 0)
+    {
+        RemoveTimer(estimateTimerID);
+        estimateTimerID = -1;
+    }
+    estimator.reset();
+    return INDI::DefaultDevice::Disconnect();
+}
+
+void FocuserLink::ioCallback(int fd, void *arg)
+{
+    INDI_UNUSED(fd);
+    static_cast<FocuserLink *>(arg)->sensorRead();
+}
+
+// Reconnects run from the event loop timer, one attempt per expiry with a
+// growing pause, so a device that stays away costs the INDI thread nothing
+// but the port check. Disconnecting by hand cancels them.
+void FocuserLink::scheduleReconnect()
+{
+    if (reconnectTimerID >= 0)
+        IERmTimer(reconnectTimerID);
+    reconnectTimerID = IEAddTimer(reconnectDelay, reconnectCallback, this);
+    reconnectDelay = std::min(reconnectDelay * 2, RECONNECT_MAX);
+}
+
+void FocuserLink::reconnectCallback(void *arg)
+{
+    static_cast<FocuserLink *>(arg)->reconnect();
+}
+
+void FocuserLink::reconnect()
 {
+    reconnectTimerID = -1;
     if (isConnected())
+        return;
+
+    // an unplugged adapter takes its device node along, no need to try the handshake
+    if (!isSimulation() && access(serialConnection->port(), F_OK) != 0)
+    {
+        LOGF_DEBUG("%s is gone, next reconnect in %d s.", serialConnection->port(), reconnectDelay / 1000);
+        scheduleReconnect();
+        return;
+    }
+
+    if (Connect())
     {
-        sensorRead();
-        SetTimer(POLLTIME);
+        setConnected(true, IPS_OK);
+        LOG_INFO("Reconnected.");
+        return;
     }
+    LOGF_WARN("Reconnect failed, next attempt in %d s.", reconnectDelay / 1000);
+    setConnected(false, IPS_ALERT);
+    scheduleReconnect();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -130,14 +287,15 @@ bool FocuserLink::initProperties()
                                         { return Handshake(); });
     registerConnection(serialConnection);
 
-    serialConnection->setDefaultPort("/dev/ttyUSB0");
+    serialConnection->setDefaultPort(defaultPort.c_str());
     serialConnection->setDefaultBaudRate(serialConnection->B_38400);
 
     // focuser settings
     IUFillNumber(&FocuserSettingsN[FS_STEP_SIZE], "FS_STEP_SIZE", "Step size [um]", "%.2f", 0, 100, 0.1, 5.0);
     IUFillNumber(&FocuserSettingsN[FS_COMPENSATION], "FS_COMPENSATION", "Compensation [steps/C]", "%.2f", -1000, 1000, 1, 0);
     IUFillNumber(&FocuserSettingsN[FS_COMP_THRESHOLD], "FS_COMP_THRESHOLD", "Compensation threshold [steps]", "%.0f", 1, 1000, 10, 10);
-    IUFillNumberVector(&FocuserSettingsNP, FocuserSettingsN, 3, getDeviceName(), "FOCUSER_SETTINGS", "Focuser settings", SETTINGS_TAB, IP_RW, 60, IPS_IDLE);
+    IUFillNumber(&FocuserSettingsN[FS_COMP_CYCLE], "FS_COMP_CYCLE", "Compensation cycle [s]", "%.0f", 1, 3600, 10, 30);
+    IUFillNumberVector(&FocuserSettingsNP, FocuserSettingsN, 4, getDeviceName(), "FOCUSER_SETTINGS", "Focuser settings", SETTINGS_TAB, IP_RW, 60, IPS_IDLE);
 
     IUFillSwitch(&FocuserCompModeS[FS_COMP_AUTO], "FS_COMP_AUTO", "AUTO", ISS_OFF);
     IUFillSwitch(&FocuserCompModeS[FS_COMP_MANUAL], "FS_COMP_MANUAL", "MANUAL", ISS_ON);
@@ -147,6 +305,167 @@ bool FocuserLink::initProperties()
     IUFillSwitch(&FocuserManualS[FS_MANUAL_OFF], "FS_MANUAL_OFF", "OFF", ISS_OFF);
     IUFillSwitchVector(&FocuserManualSP, FocuserManualS, 2, getDeviceName(), "MANUAL_CONTROLLER", "Hand controller", SETTINGS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
+    // compensation learned from accepted focus positions
+    IUFillNumber(&CompModelN[CM_SLOPE], "CM_SLOPE", "Fitted [steps/C]", "%.2f", -1000, 1000, 0, 0);
+    IUFillNumber(&CompModelN[CM_R2], "CM_R2", "R squared", "%.3f", 0, 1, 0, 0);
+    IUFillNumber(&CompModelN[CM_STDERR], "CM_STDERR", "Slope error [steps/C]", "%.2f", 0, 1000, 0, 0);
+    IUFillNumber(&CompModelN[CM_SAMPLES], "CM_SAMPLES", "Samples", "%.0f", 0, COMP_MODEL_WINDOW, 0, 0);
+    IUFillNumber(&CompModelN[CM_SPREAD], "CM_SPREAD", "Temperature spread [C]", "%.2f", 0, 100, 0, 0);
+    IUFillNumberVector(&CompModelNP, CompModelN, 5, getDeviceName(), "COMP_MODEL", "Compensation model", SETTINGS_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&CompModelOptionsN[CMO_SETTLE], "CMO_SETTLE", "Settle time [s]", "%.0f", 5, 3600, 10, 60);
+    IUFillNumber(&CompModelOptionsN[CMO_MIN_R2], "CMO_MIN_R2", "Minimum R squared", "%.2f", 0, 1, 0.05, 0.8);
+    IUFillNumberVector(&CompModelOptionsNP, CompModelOptionsN, 2, getDeviceName(), "COMP_MODEL_OPTIONS", "Model options", SETTINGS_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&CompModelModeS[CMM_PROPOSE], "CMM_PROPOSE", "Propose", ISS_ON);
+    IUFillSwitch(&CompModelModeS[CMM_AUTO], "CMM_AUTO", "Apply", ISS_OFF);
+    IUFillSwitchVector(&CompModelModeSP, CompModelModeS, 2, getDeviceName(), "COMP_MODEL_MODE", "Fitted compensation", SETTINGS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&CompModelTermsS[CMT_COMMON], "CMT_COMMON", "Common", ISS_ON);
+    IUFillSwitch(&CompModelTermsS[CMT_PER_FILTER], "CMT_PER_FILTER", "Per filter", ISS_OFF);
+    IUFillSwitchVector(&CompModelTermsSP, CompModelTermsS, 2, getDeviceName(), "COMP_MODEL_TERMS", "Focus offsets", SETTINGS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&CompTemperatureS[CTS_RAW], "CTS_RAW", "Raw", ISS_OFF);
+    IUFillSwitch(&CompTemperatureS[CTS_FILTERED], "CTS_FILTERED", "Filtered", ISS_ON);
+    IUFillSwitchVector(&CompTemperatureSP, CompTemperatureS, 2, getDeviceName(), "COMP_TEMPERATURE", "Model temperature", SETTINGS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&CompModelActionS[CMA_ACCEPT], "CMA_ACCEPT", "Accept focus", ISS_OFF);
+    IUFillSwitch(&CompModelActionS[CMA_APPLY], "CMA_APPLY", "Apply fit", ISS_OFF);
+    IUFillSwitch(&CompModelActionS[CMA_RESET], "CMA_RESET", "Reset", ISS_OFF);
+    IUFillSwitchVector(&CompModelActionSP, CompModelActionS, 3, getDeviceName(), "COMP_MODEL_ACTION", "Model", SETTINGS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+
+    // polling cadences
+    IUFillNumber(&PollingN[PI_MOVING], "PI_MOVING", "Moving [ms]", "%.0f", 20, 1000, 10, POLL_MOVING);
+    IUFillNumber(&PollingN[PI_IDLE], "PI_IDLE", "Idle [ms]", "%.0f", 100, 60000, 100, POLL_IDLE);
+    IUFillNumber(&PollingN[PI_ENVIRONMENT], "PI_ENVIRONMENT", "Environment [ms]", "%.0f", 500, 600000, 500, POLL_ENVIRONMENT);
+    IUFillNumber(&PollingN[PI_SETTINGS], "PI_SETTINGS", "Settings [ms]", "%.0f", 1000, 3600000, 1000, POLL_SETTINGS);
+    IUFillNumber(&PollingN[PI_ESTIMATE], "PI_ESTIMATE", "Position estimate [ms]", "%.0f", 0, 1000, 10, 100);
+    IUFillNumberVector(&PollingNP, PollingN, 5, getDeviceName(), "POLLING_INTERVALS", "Polling", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // change-only publishing
+    IUFillNumber(&DeadbandN[DB_TEMPERATURE], "DB_TEMPERATURE", "Temperature [C]", "%.2f", 0, 5, 0.05, 0.1);
+    IUFillNumber(&DeadbandN[DB_HUMIDITY], "DB_HUMIDITY", "Humidity [%]", "%.1f", 0, 20, 0.5, 1.0);
+    IUFillNumber(&DeadbandN[DB_DEWPOINT], "DB_DEWPOINT", "Dew point [C]", "%.2f", 0, 5, 0.05, 0.1);
+    IUFillNumberVector(&DeadbandNP, DeadbandN, 3, getDeviceName(), "PUBLISH_DEADBANDS", "Deadbands", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // weather filters, the filtered values are published as weather parameters
+    IUFillSwitch(&WeatherFilterS[WFM_RAW], "WFM_RAW", "Raw", ISS_OFF);
+    IUFillSwitch(&WeatherFilterS[WFM_EMA], "WFM_EMA", "Moving average", ISS_OFF);
+    IUFillSwitch(&WeatherFilterS[WFM_MEDIAN], "WFM_MEDIAN", "Median", ISS_ON);
+    IUFillSwitchVector(&WeatherFilterSP, WeatherFilterS, 3, getDeviceName(), "WEATHER_FILTER", "Filter", ENVIRONMENT_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+    IUFillNumber(&WeatherFilterOptionsN[WFO_ALPHA], "WFO_ALPHA", "Average weight", "%.2f", 0.01, 1, 0.05, 0.3);
+    IUFillNumber(&WeatherFilterOptionsN[WFO_WINDOW], "WFO_WINDOW", "Window [samples]", "%.0f", 1, FILTER_MAX_WINDOW, 1, 9);
+    IUFillNumberVector(&WeatherFilterOptionsNP, WeatherFilterOptionsN, 2, getDeviceName(), "WEATHER_FILTER_OPTIONS", "Filter options", ENVIRONMENT_TAB, IP_RW, 60, IPS_IDLE);
+    for (FocuserLinkFilter &filter : weatherFilters)
+        filter.configure(WeatherFilterOptionsN[WFO_ALPHA].value, WeatherFilterOptionsN[WFO_WINDOW].value);
+
+    IUFillNumber(&WeatherRawN[DB_TEMPERATURE], "RAW_TEMPERATURE", "Temperature [C]", "%.2f", -50, 50, 0, 0);
+    IUFillNumber(&WeatherRawN[DB_HUMIDITY], "RAW_HUMIDITY", "Humidity [%]", "%.1f", 0, 100, 0, 0);
+    IUFillNumber(&WeatherRawN[DB_DEWPOINT], "RAW_DEWPOINT", "Dew point [C]", "%.2f", -50, 50, 0, 0);
+    IUFillNumberVector(&WeatherRawNP, WeatherRawN, 3, getDeviceName(), "WEATHER_RAW", "Raw readings", ENVIRONMENT_TAB, IP_RO, 60, IPS_IDLE);
+
+    const char *channels[] = { "TEMPERATURE", "HUMIDITY", "DEWPOINT" };
+    const char *channelLabels[] = { "Temperature", "Humidity", "Dew point" };
+    const char *trendNames[] = { "MIN", "MAX", "RATE" };
+    const char *trendLabels[] = { "min", "max", "change [1/h]" };
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < WT_N; j++)
+        {
+            char name[MAXINDINAME], label[MAXINDILABEL];
+            snprintf(name, sizeof(name), "%s_%s", channels[i], trendNames[j]);
+            snprintf(label, sizeof(label), "%s %s", channelLabels[i], trendLabels[j]);
+            IUFillNumber(&WeatherTrendsN[i * WT_N + j], name, label, "%.2f", -1000, 1000, 0, 0);
+        }
+    }
+    IUFillNumberVector(&WeatherTrendsNP, WeatherTrendsN, 3 * WT_N, getDeviceName(), "WEATHER_TRENDS", "Window trends", ENVIRONMENT_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&PublishStatsN[PS_SENT], "PS_SENT", "Sent", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&PublishStatsN[PS_SUPPRESSED], "PS_SUPPRESSED", "Suppressed", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumberVector(&PublishStatsNP, PublishStatsN, 2, getDeviceName(), "PUBLISH_STATS", "Updates", DIAGNOSTICS_TAB, IP_RO, 60, IPS_IDLE);
+
+    // serial statistics per command
+    static const char *statsNames[STATS_COMMAND_COUNT] =
+    {
+        "HANDSHAKE", "STATUS", "SETTINGS_GET", "MANUAL_GET", "MANUAL_SET", "SETTINGS_SET", "MOVE", "SYNC", "HALT", "COMPENSATE", "OTHER"
+    };
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+    {
+        char name[MAXINDINAME], label[MAXINDILABEL];
+        snprintf(name, MAXINDINAME, "SERIAL_%s", statsNames[i]);
+        snprintf(label, MAXINDILABEL, "Serial %c", FocuserLinkStats::commandAt(i));
+        IUFillNumber(&SerialStatsN[i][SS_COUNT], "SS_COUNT", "Count", "%.0f", 0, 1e12, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_TIMEOUTS], "SS_TIMEOUTS", "Timeouts", "%.0f", 0, 1e12, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_FRAMING], "SS_FRAMING", "Framing errors", "%.0f", 0, 1e12, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_ERRORS], "SS_ERRORS", "I/O errors", "%.0f", 0, 1e12, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_DISCARDED], "SS_DISCARDED", "Discarded frames", "%.0f", 0, 1e12, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_P50], "SS_P50", "p50 [ms]", "%.2f", 0, 1e6, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_P99], "SS_P99", "p99 [ms]", "%.2f", 0, 1e6, 1, 0);
+        IUFillNumber(&SerialStatsN[i][SS_MAX], "SS_MAX", "Max [ms]", "%.2f", 0, 1e6, 1, 0);
+        IUFillNumberVector(&SerialStatsNP[i], SerialStatsN[i], SS_N, getDeviceName(), name, label, DIAGNOSTICS_TAB, IP_RO, 60, IPS_IDLE);
+    }
+
+    IUFillNumber(&EstimateDriftN[ED_LAST], "ED_LAST", "Last [steps]", "%.0f", -1e6, 1e6, 1, 0);
+    IUFillNumber(&EstimateDriftN[ED_EMA], "ED_EMA", "Abs EMA [steps]", "%.1f", 0, 1e6, 1, 0);
+    IUFillNumber(&EstimateDriftN[ED_MAX], "ED_MAX", "Max abs [steps]", "%.0f", 0, 1e6, 1, 0);
+    IUFillNumberVector(&EstimateDriftNP, EstimateDriftN, 3, getDeviceName(), "ESTIMATE_DRIFT", "Estimate drift", DIAGNOSTICS_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&StatsResetS[0], "STATS_RESET", "Reset", ISS_OFF);
+    IUFillSwitchVector(&StatsResetSP, StatsResetS, 1, getDeviceName(), "STATS_RESET", "Statistics", DIAGNOSTICS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+
+    // focus offsets per filter, moved to as soon as the snooped wheel starts turning
+    IUFillText(&FilterWheelT[0], "ACTIVE_FILTER", "Filter wheel", "Filter Simulator");
+    IUFillTextVector(&FilterWheelTP, FilterWheelT, 1, getDeviceName(), "FILTER_WHEEL", "Snooped wheel", FILTERS_TAB, IP_RW, 60, IPS_IDLE);
+    IUFillNumber(&FilterSlotN[0], "FILTER_SLOT_VALUE", "Filter", "%.0f", 1, FILTER_OFFSET_SLOTS, 1, 0);
+    IUFillNumberVector(&FilterSlotNP, FilterSlotN, 1, FilterWheelT[0].text, "FILTER_SLOT", "Filter slot", FILTERS_TAB, IP_RO, 60, IPS_IDLE);
+    for (int i = 0; i < FILTER_OFFSET_SLOTS; i++)
+    {
+        char name[MAXINDINAME], label[MAXINDILABEL];
+        snprintf(name, sizeof(name), "OFFSET_%d", i + 1);
+        snprintf(label, sizeof(label), "Slot %d [steps]", i + 1);
+        IUFillNumber(&FilterOffsetN[i], name, label, "%.0f", -100000, 100000, 10, 0);
+    }
+    IUFillNumberVector(&FilterOffsetNP, FilterOffsetN, FILTER_OFFSET_SLOTS, getDeviceName(), "FILTER_OFFSETS", "Focus offsets", FILTERS_TAB, IP_RW, 60, IPS_IDLE);
+    IUFillSwitch(&FilterOffsetModeS[FOM_ON], "FOM_ON", "On", ISS_OFF);
+    IUFillSwitch(&FilterOffsetModeS[FOM_OFF], "FOM_OFF", "Off", ISS_ON);
+    IUFillSwitchVector(&FilterOffsetModeSP, FilterOffsetModeS, 2, getDeviceName(), "FILTER_OFFSET_MODE", "Move on filter change", FILTERS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+    IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+
+    // binary trace of serial and state events, always recorded
+    IUFillSwitch(&TraceDumpS[0], "TRACE_DUMP", "Dump", ISS_OFF);
+    IUFillSwitchVector(&TraceDumpSP, TraceDumpS, 1, getDeviceName(), "TRACE_DUMP", "Trace", DIAGNOSTICS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+    IUFillBLOB(&TraceB[0], "TRACE_TEXT", "Trace", ".txt");
+    IUFillBLOBVector(&TraceBP, TraceB, 1, getDeviceName(), "TRACE_DATA", "Trace data", DIAGNOSTICS_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillText(&DeviceCacheT[DC_U], "U_REPLY", "Settings", "");
+    IUFillText(&DeviceCacheT[DC_F], "F_REPLY", "Hand controller", "");
+    IUFillTextVector(&DeviceCacheTP, DeviceCacheT, 2, getDeviceName(), "DEVICE_CACHE", "Device cache", OPTIONS_TAB, IP_RO, 60, IPS_IDLE);
+
+    // Prometheus text endpoint, served while a socket path is set
+    IUFillText(&MetricsSocketT[0], "METRICS_SOCKET_PATH", "Socket", "");
+    IUFillTextVector(&MetricsSocketTP, MetricsSocketT, 1, getDeviceName(), "METRICS_SOCKET", "Metrics endpoint", DIAGNOSTICS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // serial transcript for replay, recorded while a file is set
+    IUFillText(&TranscriptT[0], "TRANSCRIPT_FILE", "File", "");
+    IUFillTextVector(&TranscriptTP, TranscriptT, 1, getDeviceName(), "TRANSCRIPT", "Serial transcript", DIAGNOSTICS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // telemetry history, empty log file keeps it in memory only
+    IUFillText(&TelemetryLogT[0], "TELEMETRY_LOG_FILE", "Log file", "");
+    IUFillTextVector(&TelemetryLogTP, TelemetryLogT, 1, getDeviceName(), "TELEMETRY_LOG", "Telemetry log", DIAGNOSTICS_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&TelemetryWindowN[TW_FROM], "TW_FROM", "From [min ago]", "%.0f", 0, 100000, 10, 60);
+    IUFillNumber(&TelemetryWindowN[TW_TO], "TW_TO", "To [min ago]", "%.0f", 0, 100000, 10, 0);
+    IUFillNumberVector(&TelemetryWindowNP, TelemetryWindowN, 2, getDeviceName(), "TELEMETRY_WINDOW", "Telemetry window", DIAGNOSTICS_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&TelemetryExportS[0], "TELEMETRY_EXPORT_CSV", "Export CSV", ISS_OFF);
+    IUFillSwitchVector(&TelemetryExportSP, TelemetryExportS, 1, getDeviceName(), "TELEMETRY_EXPORT", "Telemetry", DIAGNOSTICS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+
+    IUFillBLOB(&TelemetryCsvB[0], "TELEMETRY_CSV", "CSV", ".csv");
+    IUFillBLOBVector(&TelemetryCsvBP, TelemetryCsvB, 1, getDeviceName(), "TELEMETRY_DATA", "Telemetry data", DIAGNOSTICS_TAB, IP_RO, 60, IPS_IDLE);
+
+    telemetrySample.temperature = telemetrySample.humidity = telemetrySample.dewPoint = NAN;
+    telemetrySample.compDiff = 0;
+
     // focuser compensation
     IUFillNumber(&CompensationValueN[0], "COMP_VALUE", "Compensation steps", "%.0f", -10000, 10000, 1, 0);
     IUFillNumberVector(&CompensationValueNP, CompensationValueN, 1, getDeviceName(), "COMP_STEPS", "Compensation steps", FOCUS_TAB, IP_RO, 60, IPS_IDLE);
@@ -157,6 +476,9 @@ bool FocuserLink::initProperties()
     IUFillNumber(&FocusPosMMN[0], "FOC_POS_MM", "Position [mm]", "%.3f", 0.0, 200.0, 0.001, 0.0);
     IUFillNumberVector(&FocusPosMMNP, FocusPosMMN, 1, getDeviceName(), "FOC_POS_MM", "Position [mm]", FOCUS_TAB, IP_RO, 60, IPS_IDLE);
 
+    IUFillNumber(&FocusEtaN[0], "FOCUS_ETA_S", "Time to arrival [s]", "%.1f", 0, 10000, 0.1, 0);
+    IUFillNumberVector(&FocusEtaNP, FocusEtaN, 1, getDeviceName(), "FOCUS_ETA", "Move ETA", FOCUS_TAB, IP_RO, 60, IPS_IDLE);
+
     // Environment Group
     addParameter("WEATHER_TEMPERATURE", "Temperature (C)", -15, 35, 15);
     addParameter("WEATHER_HUMIDITY", "Humidity %", 0, 100, 15);
@@ -169,17 +491,47 @@ bool FocuserLink::updateProperties()
 {
     // Call parent update properties first
     INDI::DefaultDevice::updateProperties();
+    metrics.set(METRIC_CONNECTED, isConnected());
 
     if (isConnected())
     {
         defineProperty(&FocusPosMMNP);
+        defineProperty(&FocusEtaNP);
         FI::updateProperties();
         WI::updateProperties();
         defineProperty(&FocuserSettingsNP);
         defineProperty(&FocuserCompModeSP);
         defineProperty(&FocuserManualSP);
+        defineProperty(&CompModelNP);
+        defineProperty(&CompModelOptionsNP);
+        defineProperty(&CompModelModeSP);
+        defineProperty(&CompModelTermsSP);
+        defineProperty(&CompModelActionSP);
+        defineProperty(&CompTemperatureSP);
+        defineProperty(&WeatherFilterSP);
+        defineProperty(&WeatherFilterOptionsNP);
+        defineProperty(&WeatherRawNP);
+        defineProperty(&WeatherTrendsNP);
         defineProperty(&CompensationValueNP);
         defineProperty(&CompensateNowSP);
+        defineProperty(&FilterWheelTP);
+        defineProperty(&FilterOffsetNP);
+        defineProperty(&FilterOffsetModeSP);
+        defineProperty(&PollingNP);
+        defineProperty(&DeadbandNP);
+        defineProperty(&PublishStatsNP);
+        for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+            defineProperty(&SerialStatsNP[i]);
+        defineProperty(&EstimateDriftNP);
+        defineProperty(&StatsResetSP);
+        defineProperty(&MetricsSocketTP);
+        defineProperty(&TraceDumpSP);
+        defineProperty(&TraceBP);
+        defineProperty(&TranscriptTP);
+        defineProperty(&TelemetryLogTP);
+        defineProperty(&TelemetryWindowNP);
+        defineProperty(&TelemetryExportSP);
+        defineProperty(&TelemetryCsvBP);
     }
     else
     {
@@ -188,7 +540,36 @@ bool FocuserLink::updateProperties()
         deleteProperty(CompensationValueNP.name);
         deleteProperty(FocuserCompModeSP.name);
         deleteProperty(FocuserManualSP.name);
+        deleteProperty(CompModelNP.name);
+        deleteProperty(CompModelOptionsNP.name);
+        deleteProperty(CompModelModeSP.name);
+        deleteProperty(CompModelTermsSP.name);
+        deleteProperty(CompModelActionSP.name);
+        deleteProperty(CompTemperatureSP.name);
+        deleteProperty(WeatherFilterSP.name);
+        deleteProperty(WeatherFilterOptionsNP.name);
+        deleteProperty(WeatherRawNP.name);
+        deleteProperty(WeatherTrendsNP.name);
         deleteProperty(FocusPosMMNP.name);
+        deleteProperty(FocusEtaNP.name);
+        deleteProperty(FilterWheelTP.name);
+        deleteProperty(FilterOffsetNP.name);
+        deleteProperty(FilterOffsetModeSP.name);
+        deleteProperty(PollingNP.name);
+        deleteProperty(DeadbandNP.name);
+        deleteProperty(PublishStatsNP.name);
+        for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+            deleteProperty(SerialStatsNP[i].name);
+        deleteProperty(EstimateDriftNP.name);
+        deleteProperty(StatsResetSP.name);
+        deleteProperty(MetricsSocketTP.name);
+        deleteProperty(TraceDumpSP.name);
+        deleteProperty(TraceBP.name);
+        deleteProperty(TranscriptTP.name);
+        deleteProperty(TelemetryLogTP.name);
+        deleteProperty(TelemetryWindowNP.name);
+        deleteProperty(TelemetryExportSP.name);
+        deleteProperty(TelemetryCsvBP.name);
         FI::updateProperties();
         WI::updateProperties();
     }
@@ -200,29 +581,92 @@ bool FocuserLink::ISNewNumber(const char *dev, const char *name, double values[]
 {
     if (dev && !strcmp(dev, getDeviceName()))
     {
-        char cmd[ASTROLINK4_LEN] = {0};
-        char res[ASTROLINK4_LEN] = {0};
-
         // Focuser settings
         if (!strcmp(name, FocuserSettingsNP.name))
         {
-            bool allOk = true;
-            std::map<int, std::string> updates;
-            updates[U_STEPSIZE] = doubleToStr(values[FS_STEP_SIZE] * 100.0);
-            updates[U_COMPCYCLE] = "30"; // cycle [s]
-            updates[U_COMPSTEP] = doubleToStr(values[FS_COMPENSATION] * 100.0);
-            updates[U_COMPTRIGGER] = doubleToStr(values[FS_COMP_THRESHOLD]);
-            allOk = allOk && updateSettings("u", "U", updates);
-            updates.clear();
+            // clients may send a subset in any order, apply it by name to a
+            // copy and write the whole record
+            decltype(FocuserSettingsN) settings;
+            memcpy(settings, FocuserSettingsN, sizeof(settings));
+            INumberVectorProperty update = FocuserSettingsNP;
+            update.np = settings;
+
+            FocuserLinkSchema::SettingsPatch patch;
+            bool allOk = IUUpdateNumber(&update, values, names, n) == 0
+                         && patch.set<&FocuserLinkProtocol::URecord::stepSize>(settings[FS_STEP_SIZE].value)
+                         && patch.set<&FocuserLinkProtocol::URecord::compCycle>(settings[FS_COMP_CYCLE].value)
+                         && patch.set<&FocuserLinkProtocol::URecord::compStep>(settings[FS_COMPENSATION].value)
+                         && patch.set<&FocuserLinkProtocol::URecord::compTrigger>(settings[FS_COMP_THRESHOLD].value)
+                         && io.submitSettings(patch);
             if (allOk)
             {
+                memcpy(FocuserSettingsN, settings, sizeof(settings));
                 FocuserSettingsNP.s = IPS_BUSY;
-                IUUpdateNumber(&FocuserSettingsNP, values, names, n);
                 IDSetNumber(&FocuserSettingsNP, nullptr);
-                LOG_INFO(values[FS_COMPENSATION] > 0 ? "Temperature compensation is enabled." : "Temperature compensation is disabled.");
+                LOG_INFO(settings[FS_COMPENSATION].value > 0 ? "Temperature compensation is enabled." : "Temperature compensation is disabled.");
                 return true;
             }
             FocuserSettingsNP.s = IPS_ALERT;
+            IDSetNumber(&FocuserSettingsNP, nullptr);
+            return true;
+        }
+
+        // Compensation model options
+        if (!strcmp(name, CompModelOptionsNP.name))
+        {
+            IUUpdateNumber(&CompModelOptionsNP, values, names, n);
+            CompModelOptionsNP.s = IPS_OK;
+            IDSetNumber(&CompModelOptionsNP, nullptr);
+            updateCompModel();
+            return true;
+        }
+
+        // Filter offsets
+        if (!strcmp(name, FilterOffsetNP.name))
+        {
+            IUUpdateNumber(&FilterOffsetNP, values, names, n);
+            FilterOffsetNP.s = IPS_OK;
+            IDSetNumber(&FilterOffsetNP, nullptr);
+            return true;
+        }
+
+        // Weather filter options, the windows start over
+        if (!strcmp(name, WeatherFilterOptionsNP.name))
+        {
+            IUUpdateNumber(&WeatherFilterOptionsNP, values, names, n);
+            for (FocuserLinkFilter &filter : weatherFilters)
+                filter.configure(WeatherFilterOptionsN[WFO_ALPHA].value, WeatherFilterOptionsN[WFO_WINDOW].value);
+            WeatherFilterOptionsNP.s = IPS_OK;
+            IDSetNumber(&WeatherFilterOptionsNP, nullptr);
+            return true;
+        }
+
+        // Polling cadences
+        if (!strcmp(name, PollingNP.name))
+        {
+            IUUpdateNumber(&PollingNP, values, names, n);
+            io.setPolling(PollingN[PI_MOVING].value, PollingN[PI_IDLE].value, PollingN[PI_ENVIRONMENT].value,
+                          PollingN[PI_SETTINGS].value);
+            PollingNP.s = IPS_OK;
+            IDSetNumber(&PollingNP, nullptr);
+            return true;
+        }
+
+        // Weather deadbands
+        if (!strcmp(name, DeadbandNP.name))
+        {
+            IUUpdateNumber(&DeadbandNP, values, names, n);
+            DeadbandNP.s = IPS_OK;
+            IDSetNumber(&DeadbandNP, nullptr);
+            return true;
+        }
+
+        // Telemetry export window
+        if (!strcmp(name, TelemetryWindowNP.name))
+        {
+            IUUpdateNumber(&TelemetryWindowNP, values, names, n);
+            TelemetryWindowNP.s = IPS_OK;
+            IDSetNumber(&TelemetryWindowNP, nullptr);
             return true;
         }
 
@@ -240,13 +684,20 @@ bool FocuserLink::ISNewSwitch(const char *dev, const char *name, ISState *states
     if (dev && !strcmp(dev, getDeviceName()))
     {
         char cmd[ASTROLINK4_LEN] = {0};
-        char res[ASTROLINK4_LEN] = {0};
 
         // compensate now
         if (!strcmp(name, CompensateNowSP.name))
         {
-            sprintf(cmd, "S:%d", static_cast<uint16_t>(FocuserSettingsN[FS_COMP_THRESHOLD].value));
-            bool allOk = sendCommand(cmd, res);
+            FocuserLinkProtocol::formatCompensate(static_cast<uint16_t>(FocuserSettingsN[FS_COMP_THRESHOLD].value), cmd,
+                                                  ASTROLINK4_LEN);
+            bool allOk = io.submitCommand(cmd, [this](bool ok, const char *)
+            {
+                if (!ok)
+                {
+                    CompensateNowSP.s = IPS_ALERT;
+                    IDSetSwitch(&CompensateNowSP, nullptr);
+                }
+            });
             CompensateNowSP.s = allOk ? IPS_BUSY : IPS_ALERT;
             if (allOk)
                 IUUpdateSwitch(&CompensateNowSP, states, names, n);
@@ -258,8 +709,16 @@ bool FocuserLink::ISNewSwitch(const char *dev, const char *name, ISState *states
         // Manual mode
         if (!strcmp(name, FocuserManualSP.name))
         {
-            sprintf(cmd, "F:%s", (strcmp(FocuserManualS[0].name, names[0])) ? "0" : "1");
-            if (sendCommand(cmd, res))
+            FocuserLinkProtocol::formatManual(!strcmp(FocuserManualS[0].name, names[0]), cmd, ASTROLINK4_LEN);
+            bool submitted = io.submitCommand(cmd, [this](bool ok, const char *)
+            {
+                if (!ok)
+                {
+                    FocuserManualSP.s = IPS_ALERT;
+                    IDSetSwitch(&FocuserManualSP, nullptr);
+                }
+            });
+            if (submitted)
             {
                 FocuserManualSP.s = IPS_BUSY;
                 IUUpdateSwitch(&FocuserManualSP, states, names, n);
@@ -273,10 +732,8 @@ bool FocuserLink::ISNewSwitch(const char *dev, const char *name, ISState *states
         // Focuser compensation mode
         if (!strcmp(name, FocuserCompModeSP.name))
         {
-            std::string value = "0";
-            if (!strcmp(FocuserCompModeS[FS_COMP_AUTO].name, names[0]))
-                value = "1";
-            if (updateSettings("u", "U", U_COMPAUTO, value.c_str()))
+            bool automatic = !strcmp(FocuserCompModeS[FS_COMP_AUTO].name, names[0]);
+            if (updateSetting<&FocuserLinkProtocol::URecord::compAuto>(automatic))
             {
                 FocuserCompModeSP.s = IPS_BUSY;
                 IUUpdateSwitch(&FocuserCompModeSP, states, names, n);
@@ -287,6 +744,92 @@ bool FocuserLink::ISNewSwitch(const char *dev, const char *name, ISState *states
             return true;
         }
 
+        // Compensation model
+        if (!strcmp(name, CompModelModeSP.name) || !strcmp(name, CompModelTermsSP.name))
+        {
+            ISwitchVectorProperty *svp = !strcmp(name, CompModelModeSP.name) ? &CompModelModeSP : &CompModelTermsSP;
+            IUUpdateSwitch(svp, states, names, n);
+            svp->s = IPS_OK;
+            IDSetSwitch(svp, nullptr);
+            updateCompModel();
+            return true;
+        }
+
+        if (!strcmp(name, CompModelActionSP.name))
+        {
+            IUUpdateSwitch(&CompModelActionSP, states, names, n);
+            bool ok = true;
+            switch (IUFindOnSwitchIndex(&CompModelActionSP))
+            {
+                case CMA_ACCEPT:
+                    ok = acceptFocus();
+                    break;
+                case CMA_APPLY:
+                {
+                    FocuserLinkCompModel::Fit fit = compModel.fit(CompModelTermsS[CMT_PER_FILTER].s == ISS_ON);
+                    ok = fit.valid && applyCompSlope(fit.slope);
+                    break;
+                }
+                case CMA_RESET:
+                    compModel.reset();
+                    updateCompModel();
+                    break;
+            }
+            IUResetSwitch(&CompModelActionSP);
+            CompModelActionSP.s = ok ? IPS_OK : IPS_ALERT;
+            IDSetSwitch(&CompModelActionSP, nullptr);
+            return true;
+        }
+
+        // Reset diagnostics counters
+        if (!strcmp(name, StatsResetSP.name))
+        {
+            serialStats.reset();
+            publishSent = publishSuppressed = 0;
+            for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+                SerialStatsNP[i].s = IPS_IDLE;
+            updateSerialStats();
+            estimator.resetDrift();
+            updateEstimateDrift();
+            StatsResetS[0].s = ISS_OFF;
+            StatsResetSP.s = IPS_OK;
+            IDSetSwitch(&StatsResetSP, nullptr);
+            return true;
+        }
+
+        // Weather filter and compensation model input
+        if (!strcmp(name, WeatherFilterSP.name) || !strcmp(name, CompTemperatureSP.name))
+        {
+            ISwitchVectorProperty *svp = !strcmp(name, WeatherFilterSP.name) ? &WeatherFilterSP : &CompTemperatureSP;
+            IUUpdateSwitch(svp, states, names, n);
+            svp->s = IPS_OK;
+            IDSetSwitch(svp, nullptr);
+            return true;
+        }
+
+        // Filter offset moves
+        if (!strcmp(name, FilterOffsetModeSP.name))
+        {
+            IUUpdateSwitch(&FilterOffsetModeSP, states, names, n);
+            FilterOffsetModeSP.s = IPS_OK;
+            IDSetSwitch(&FilterOffsetModeSP, nullptr);
+            return true;
+        }
+
+        // Telemetry export
+        if (!strcmp(name, TelemetryExportSP.name))
+        {
+            exportTelemetry();
+            return true;
+        }
+
+        // Trace dump
+        if (!strcmp(name, TraceDumpSP.name))
+        {
+            exportTrace();
+            return true;
+        }
+
         if (strstr(name, "FOCUS"))
             return FI::processSwitch(dev, name, states, names, n);
     }
@@ -296,13 +839,132 @@ bool FocuserLink::ISNewSwitch(const char *dev, const char *name, ISState *states
 
 bool FocuserLink::ISNewText(const char *dev, const char *name, char *texts[], char *names[], int n)
 {
+    if (dev && !strcmp(dev, getDeviceName()))
+    {
+        // Snooped filter wheel
+        if (!strcmp(name, FilterWheelTP.name))
+        {
+            IUUpdateText(&FilterWheelTP, texts, names, n);
+            strncpy(FilterSlotNP.device, FilterWheelT[0].text, MAXINDIDEVICE - 1);
+            FilterSlotNP.device[MAXINDIDEVICE - 1] = '\0';
+            IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+            offsetSlot = 0;
+            FilterWheelTP.s = IPS_OK;
+            IDSetText(&FilterWheelTP, nullptr);
+            return true;
+        }
+
+        // the cache is read at handshake, a later config load must not bring back an old one
+        if (!strcmp(name, DeviceCacheTP.name))
+            return true;
+
+        // Metrics endpoint, also applied when the config is loaded
+        if (!strcmp(name, MetricsSocketTP.name))
+        {
+            IUUpdateText(&MetricsSocketTP, texts, names, n);
+            const char *path = MetricsSocketT[0].text;
+            metrics.stop();
+            MetricsSocketTP.s = IPS_IDLE;
+            if (path != nullptr && path[0] != '\0')
+            {
+                metrics.setDevice(getDeviceName());
+                if (metrics.start(path))
+                {
+                    LOGF_INFO("Metrics are served on %s.", path);
+                    MetricsSocketTP.s = IPS_OK;
+                }
+                else
+                {
+                    LOGF_ERROR("Cannot serve metrics on %s: %s", path, strerror(metrics.lastErrno()));
+                    MetricsSocketTP.s = IPS_ALERT;
+                }
+            }
+            IDSetText(&MetricsSocketTP, nullptr);
+            return true;
+        }
+
+        // Serial transcript
+        if (!strcmp(name, TranscriptTP.name))
+        {
+            IUUpdateText(&TranscriptTP, texts, names, n);
+            const char *path = TranscriptT[0].text;
+            if (transcript.isOpen())
+                LOGF_INFO("Transcript closed after %lu exchanges.", transcript.records());
+            transcript.close();
+            TranscriptTP.s = IPS_IDLE;
+            if (path != nullptr && path[0] != '\0')
+            {
+                if (transcript.open(path))
+                {
+                    LOGF_INFO("Recording serial transcript to %s.", path);
+                    TranscriptTP.s = IPS_BUSY;
+                }
+                else
+                {
+                    LOGF_ERROR("Cannot open transcript %s: %s", path, strerror(errno));
+                    TranscriptTP.s = IPS_ALERT;
+                }
+            }
+            IDSetText(&TranscriptTP, nullptr);
+            return true;
+        }
+
+        // Telemetry log file, also applied when the config is loaded
+        if (!strcmp(name, TelemetryLogTP.name))
+        {
+            IUUpdateText(&TelemetryLogTP, texts, names, n);
+            const char *path = TelemetryLogT[0].text;
+            if (path == nullptr || path[0] == '\0')
+            {
+                telemetry.closeLog();
+                TelemetryLogTP.s = IPS_IDLE;
+            }
+            else if (telemetry.openLog(path))
+            {
+                LOGF_INFO("Telemetry is logged to %s, %zu samples kept.", path, telemetry.size());
+                TelemetryLogTP.s = IPS_OK;
+            }
+            else
+            {
+                LOGF_ERROR("Cannot open telemetry log %s: %s", path, strerror(telemetry.lastErrno()));
+                TelemetryLogTP.s = IPS_ALERT;
+            }
+            IDSetText(&TelemetryLogTP, nullptr);
+            return true;
+        }
+    }
+
     return INDI::DefaultDevice::ISNewText(dev, name, texts, names, n);
 }
 
+bool FocuserLink::ISSnoopDevice(XMLEle *root)
+{
+    const char *device = findXMLAttValu(root, "device");
+    if (!strcmp(device, FilterSlotNP.device) && IUSnoopNumber(root, &FilterSlotNP) == 0)
+        filterSlotChanged();
+
+    return INDI::DefaultDevice::ISSnoopDevice(root);
+}
+
 bool FocuserLink::saveConfigItems(FILE *fp)
 {
     INDI::DefaultDevice::saveConfigItems(fp);
     FI::saveConfigItems(fp);
+    IUSaveConfigNumber(fp, &PollingNP);
+    IUSaveConfigNumber(fp, &DeadbandNP);
+    IUSaveConfigNumber(fp, &CompModelOptionsNP);
+    IUSaveConfigSwitch(fp, &CompModelModeSP);
+    IUSaveConfigSwitch(fp, &CompModelTermsSP);
+    IUSaveConfigSwitch(fp, &CompTemperatureSP);
+    IUSaveConfigSwitch(fp, &WeatherFilterSP);
+    IUSaveConfigNumber(fp, &WeatherFilterOptionsNP);
+    IUSaveConfigText(fp, &FilterWheelTP);
+    IUSaveConfigNumber(fp, &FilterOffsetNP);
+    IUSaveConfigSwitch(fp, &FilterOffsetModeSP);
+    IUSaveConfigText(fp, &DeviceCacheTP);
+    IUSaveConfigText(fp, &MetricsSocketTP);
+    IUSaveConfigText(fp, &TelemetryLogTP);
+    IUSaveConfigNumber(fp, &TelemetryWindowNP);
 
     return true;
 }
@@ -312,53 +974,64 @@ bool FocuserLink::saveConfigItems(FILE *fp)
 //////////////////////////////////////////////////////////////////////
 IPState FocuserLink::MoveAbsFocuser(uint32_t targetTicks)
 {
-    int32_t backlash = 0;
-    if (backlashEnabled)
-    {
-        if ((targetTicks > FocusAbsPosN[0].value) == (backlashSteps > 0))
-        {
-            if ((targetTicks + backlash) < 0 || (targetTicks + backlash) > FocusMaxPosN[0].value)
-            {
-                backlash = 0;
-            }
-            else
-            {
-                backlash = backlashSteps;
-                requireBacklashReturn = true;
-            }
-        }
-    }
-    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
-    snprintf(cmd, ASTROLINK4_LEN, "R:0:%u", targetTicks + backlash);
-    return (sendCommand(cmd, res)) ? IPS_BUSY : IPS_ALERT;
+    // only where a client sends the focuser can be a focus result
+    IPState state = moveFocuser(targetTicks);
+    focusCandidate = state == IPS_BUSY;
+    return state;
 }
 
 IPState FocuserLink::MoveRelFocuser(FocusDirection dir, uint32_t ticks)
 {
-    return MoveAbsFocuser(dir == FOCUS_INWARD ? FocusAbsPosN[0].value - ticks : FocusAbsPosN[0].value + ticks);
+    int32_t delta = dir == FOCUS_INWARD ? -static_cast<int32_t>(ticks) : static_cast<int32_t>(ticks);
+    return moveFocuser(std::max(0, hardwarePosition + delta));
+}
+
+IPState FocuserLink::moveFocuser(uint32_t targetTicks)
+{
+    // overshoot and return are one planned move run by the I/O worker
+    FocuserLinkMotionPlan plan = FocuserLinkMotion::plan(hardwarePosition, targetTicks,
+                                 backlashEnabled ? backlashSteps : 0, FocusMaxPosN[0].value);
+    trace.record(FocuserLinkTraceEntry::TRACE_MOVE, 'R', plan.legCount, targetTicks);
+    focusCandidate = false;
+    candidateIdle = false;
+    return io.submitMove(plan, [this](bool ok, const char *)
+    {
+        motionDone(ok);
+    }) ? IPS_BUSY : IPS_ALERT;
 }
 
 bool FocuserLink::AbortFocuser()
 {
-    char res[ASTROLINK4_LEN] = {0};
-    return (sendCommand("H", res));
+    focusCandidate = false;
+    return io.submitCommand(COMMAND_STOP, [this](bool ok, const char *)
+    {
+        motionDone(ok);
+    });
 }
 
 bool FocuserLink::ReverseFocuser(bool enabled)
 {
-    return updateSettings("u", "U", U_REVERSED, (enabled) ? "1" : "0");
+    return updateSetting<&FocuserLinkProtocol::URecord::reversed>(enabled);
 }
 
 bool FocuserLink::SyncFocuser(uint32_t ticks)
 {
-    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
-    snprintf(cmd, ASTROLINK4_LEN, "P:%u", ticks);
-    return sendCommand(cmd, res);
+    char cmd[ASTROLINK4_LEN] = {0};
+    FocuserLinkProtocol::formatSync(ticks, cmd, ASTROLINK4_LEN);
+    // learned positions follow the new numbering
+    int32_t delta = static_cast<int32_t>(ticks) - hardwarePosition;
+    focusCandidate = false;
+    return io.submitCommand(cmd, [this, delta](bool ok, const char *)
+    {
+        if (ok)
+            compModel.shift(delta);
+        motionDone(ok);
+    });
 }
 
 bool FocuserLink::SetFocuserMaxPosition(uint32_t ticks)
 {
-    if (updateSettings("u", "U", U_MAX_POS, std::to_string(ticks).c_str()))
+    if (updateSetting<&FocuserLinkProtocol::URecord::maxPos>(ticks))
     {
         FocuserSettingsNP.s = IPS_BUSY;
         return true;
@@ -382,63 +1055,87 @@ bool FocuserLink::SetFocuserBacklashEnabled(bool enabled)
 }
 
 //////////////////////////////////////////////////////////////////////
-/// Serial commands
+/// Serial traffic
 //////////////////////////////////////////////////////////////////////
-bool FocuserLink::sendCommand(const char *cmd, char *res)
-{
-    int nbytes_read = 0, nbytes_written = 0, tty_rc = 0;
-    char command[ASTROLINK4_LEN];
-
-    if (isSimulation())
-    {
-        // if(strcmp(cmd, "#") == 0) sprintf(res, "%s\n", "#:FocuserLink");
-        // if(strcmp(cmd, "q") == 0) sprintf(res, "%s\n", "q:1234:0:1.47:1:2.12:45.1:-12.81:1:-25.22:45:0:0:0:1:12.1:5.0:1.12:13.41:0:34:0:0");
-        // if(strcmp(cmd, "p") == 0) sprintf(res, "%s\n", "p:1234");
-        // if(strcmp(cmd, "i") == 0) sprintf(res, "%s\n", "i:0");
-        // if(strcmp(cmd, "n") == 0) sprintf(res, "%s\n", "n:1077:14.0:10.0:100");
-        // if(strcmp(cmd, "e") == 0) sprintf(res, "%s\n", "e:30:1200:1:0:20");
-        // if(strcmp(cmd, "u") == 0) sprintf(res, "%s\n", "u:25000:220:0:100:440:0:0:1:257:0:0:0:0:0:1:0:0");
-        // if(strncmp(cmd, "R", 1) == 0) sprintf(res, "%s\n", "R:");
-        // if(strncmp(cmd, "C", 1) == 0) sprintf(res, "%s\n", "C:");
-        // if(strncmp(cmd, "B", 1) == 0) sprintf(res, "%s\n", "B:");
-        // if(strncmp(cmd, "H", 1) == 0) sprintf(res, "%s\n", "H:");
-        // if(strncmp(cmd, "P", 1) == 0) sprintf(res, "%s\n", "P:");
-        // if(strncmp(cmd, "U", 1) == 0) sprintf(res, "%s\n", "U:");
-        // if(strncmp(cmd, "S", 1) == 0) sprintf(res, "%s\n", "S:");
-        // if(strncmp(cmd, "G", 1) == 0) sprintf(res, "%s\n", "G:");
-        // if(strncmp(cmd, "K", 1) == 0) sprintf(res, "%s\n", "K:");
-        // if(strncmp(cmd, "N", 1) == 0) sprintf(res, "%s\n", "N:");
-        // if(strncmp(cmd, "E", 1) == 0) sprintf(res, "%s\n", "E:");
-    }
-    else
+void FocuserLink::setClientHooks()
+{
+    // run on the reactor once connected, must not block the other devices
+    FocuserLinkClient::Hooks hooks;
+    hooks.exchanged = [this](const char *cmd, const char *reply, std::chrono::steady_clock::time_point started,
+                             uint32_t micros, FocuserLinkPort::Result rc)
     {
-        tcflush(PortFD, TCIOFLUSH);
-        sprintf(command, "%s\n", cmd);
-        LOGF_DEBUG("CMD %s", command);
-        if ((tty_rc = tty_write_string(PortFD, command, &nbytes_written)) != TTY_OK)
-            return false;
-
-        if (!res)
+        transcript.record(cmd, reply, started, micros, exchangeResult(rc));
+        trace.record(FocuserLinkTraceEntry::TRACE_EXCHANGE, cmd[0], rc, micros, strlen(cmd) + 1,
+                     reply[0] ? strlen(reply) + 1 : 0);
+    };
+    hooks.failed = [this](char command, FocuserLinkStats::Result result, int error)
+    {
+        switch (result)
         {
-            tcflush(PortFD, TCIOFLUSH);
-            return true;
+            case FocuserLinkStats::RESULT_TIMEOUT:
+                serialNote(command, SN_TIMEOUT, 0);
+                break;
+            case FocuserLinkStats::RESULT_FRAMING:
+                serialNote(command, SN_FRAMING, 0);
+                break;
+            default:
+                serialNote(command, SN_ERROR, error);
+                break;
         }
+    };
+    hooks.discarded = [this](char command, unsigned long frames)
+    {
+        trace.record(FocuserLinkTraceEntry::TRACE_DISCARD, command, 0, frames);
+    };
+    hooks.recovering = [this](FocuserLinkClient::Recovery recovery, int failures)
+    {
+        bool resync = recovery == FocuserLinkClient::RECOVERY_RESYNC;
+        serialNote(0, resync ? SN_RESYNC : SN_LINK_LOST, failures);
+        trace.record(FocuserLinkTraceEntry::TRACE_LINK, 0, resync ? 0 : 1, failures);
+    };
+    client.setHooks(hooks);
+}
 
-        if ((tty_rc = tty_nread_section(PortFD, res, ASTROLINK4_LEN, stopChar, ASTROLINK4_TIMEOUT, &nbytes_read)) != TTY_OK || nbytes_read == 1)
-            return false;
+void FocuserLink::serialNote(char command, int note, int arg)
+{
+    // INDI messages must not be written from the reactor, the session hands
+    // them to the INDI thread; the handshake still runs on the INDI thread
+    if (io.isRunning())
+        io.reportSerial(command, note, arg);
+    else
+        logSerial(command, note, arg);
+}
 
-        tcflush(PortFD, TCIOFLUSH);
-        res[nbytes_read - 1] = '\0';
-        LOGF_DEBUG("RES %s", res);
-        if (tty_rc != TTY_OK)
-        {
-            char errorMessage[MAXRBUF];
-            tty_error_msg(tty_rc, errorMessage, MAXRBUF);
-            LOGF_ERROR("Serial error: %s", errorMessage);
-            return false;
-        }
+void FocuserLink::logSerial(char command, int note, int arg)
+{
+    switch (note)
+    {
+        case SN_TIMEOUT:
+            LOGF_ERROR("Serial error on %c: timeout.", command);
+            dumpTrace("serial timeout");
+            break;
+        case SN_FRAMING:
+            LOGF_ERROR("Invalid reply to %c.", command);
+            break;
+        case SN_ERROR:
+            LOGF_ERROR("Serial error on %c: %s", command, strerror(arg));
+            dumpTrace("serial error");
+            break;
+        case SN_RESYNC:
+            LOGF_WARN("%d failed exchanges in a row, resynchronising the line.", arg);
+            break;
+        case SN_LINK_LOST:
+            LOGF_ERROR("Line lost after %d failed exchanges, reconnecting.", arg);
+            break;
     }
-    return (cmd[0] == res[0]);
+}
+
+void FocuserLink::motionDone(bool ok)
+{
+    if (ok)
+        return;
+    FocusAbsPosNP.s = IPS_ALERT;
+    IDSetNumber(&FocusAbsPosNP, nullptr);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -446,134 +1143,576 @@ bool FocuserLink::sendCommand(const char *cmd, char *res)
 //////////////////////////////////////////////////////////////////////
 bool FocuserLink::sensorRead()
 {
-    char res[ASTROLINK4_LEN] = {0};
-    if (sendCommand("q", res))
-    {
-        std::vector<std::string> result = split(res, ":");
+    // called on the INDI thread whenever the I/O worker has results
+    io.clearNotify();
 
-        float focuserPosition = std::stod(result[Q_STEPPER_POS]);
-        FocusAbsPosN[0].value = focuserPosition;
-        FocusPosMMN[0].value = focuserPosition * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0;
-        float stepsToGo = std::stod(result[Q_STEPS_TO_GO]);
-        if (stepsToGo == 0)
+    FocuserLinkEvent event;
+    while (io.nextEvent(event))
+    {
+        switch (event.type)
         {
-            if (requireBacklashReturn)
+            case FocuserLinkEvent::EVENT_Q:
             {
-                requireBacklashReturn = false;
-                MoveAbsFocuser(focuserPosition - backlashSteps);
+                const FocuserLinkProtocol::QRecord &q = event.q;
+                // hardware sample replaces the estimate, the timer interpolates until the next one
+                estimator.sample(event.time, q.stepperPos, q.stepsToGo, event.plannedSteps, event.rate);
+                if (estimator.moving() && PollingN[PI_ESTIMATE].value > 0 && estimateTimerID < 0)
+                    estimateTimerID = SetTimer(PollingN[PI_ESTIMATE].value);
+
+                hardwarePosition = q.stepperPos;
+                float focuserPosition = q.stepperPos;
+                bool posChanged = updateValue(FocusAbsPosN[0].value, focuserPosition);
+                bool mmChanged = updateValue(FocusPosMMN[0].value, focuserPosition * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0);
+                bool relChanged = false;
+                // between the legs of a planned move stepsToGo is 0 but the move is not done
+                IPState motionState = (q.stepsToGo == 0 && event.plannedSteps == 0) ? IPS_OK : IPS_BUSY;
+                metrics.set(METRIC_POSITION, q.stepperPos);
+                metrics.set(METRIC_STEPS_TO_GO, q.stepsToGo);
+                metrics.set(METRIC_MOVING, motionState == IPS_BUSY);
+                if (lastPollTime.time_since_epoch().count() != 0)
+                    metrics.set(METRIC_POLL_CYCLE, std::chrono::duration<double>(event.time - lastPollTime).count());
+                lastPollTime = event.time;
+                bool etaChanged = updateValue(FocusEtaN[0].value, event.eta, 0.1);
+                if (FocusAbsPosNP.s != motionState)
+                    trace.record(FocuserLinkTraceEntry::TRACE_STATE, 'M', motionState, q.stepperPos);
+                etaChanged |= updateState(FocusEtaNP.s, motionState);
+                posChanged |= updateState(FocusAbsPosNP.s, motionState);
+                mmChanged |= updateState(FocusPosMMNP.s, motionState);
+                relChanged |= updateState(FocusRelPosNP.s, motionState);
+                // relative position is only reported once the move is done
+                publish(&FocusRelPosNP, relChanged && motionState == IPS_OK);
+                publish(&FocusPosMMNP, mmChanged);
+                publish(&FocusAbsPosNP, posChanged);
+                publish(&FocusEtaNP, etaChanged);
+                recordTelemetry(q);
+                learnFocus(q, motionState);
+
+                if (q.hasEnvironment)
+                {
+                    if (q.sens1Type > 0)
+                        filterWeather(q, event.time);
+                    else
+                        compTemperature = NAN;
+
+                    metrics.set(METRIC_COMP_DIFF, q.compDiff);
+                    bool compChanged = updateValue(CompensationValueN[0].value, q.compDiff);
+                    IPState compState = (CompensationValueN[0].value > 0) ? IPS_OK : IPS_IDLE;
+                    if (CompensationValueNP.s != compState)
+                        trace.record(FocuserLinkTraceEntry::TRACE_STATE, 'C', compState, q.stepperPos);
+                    compChanged |= updateState(CompensationValueNP.s, compState);
+                    bool nowChanged = updateState(CompensateNowSP.s, compState);
+                    nowChanged |= updateSwitch(CompensateNowS[0].s, (CompensationValueN[0].value != 0) ? ISS_OFF : ISS_ON);
+                    publish(&CompensationValueNP, compChanged);
+                    publish(&CompensateNowSP, nowChanged);
+                }
+                break;
             }
-            FocusAbsPosNP.s = FocusRelPosNP.s = FocusPosMMNP.s = IPS_OK;
-            IDSetNumber(&FocusRelPosNP, nullptr);
-        }
-        else
-        {
-            FocusAbsPosNP.s = FocusRelPosNP.s = FocusPosMMNP.s = IPS_BUSY;
-        }
-        IDSetNumber(&FocusPosMMNP, nullptr);
-        IDSetNumber(&FocusAbsPosNP, nullptr);
 
-        if (result.size() > 5)
-        {
-            if (std::stod(result[Q_SENS1_TYPE]) > 0)
+            // settings data, read after start, after every change and on the settings poll
+            case FocuserLinkEvent::EVENT_U:
             {
-                setParameterValue("WEATHER_TEMPERATURE", std::stod(result[Q_SENS1_TEMP]));
-                setParameterValue("WEATHER_HUMIDITY", std::stod(result[Q_SENS1_HUM]));
-                setParameterValue("WEATHER_DEWPOINT", std::stod(result[Q_SENS1_DEW]));
+                verifySettings(event);
+                const FocuserLinkProtocol::URecord &u = event.u;
+                bool settingsChanged = false;
+                settingsChanged |= updateValue(FocuserSettingsN[FS_STEP_SIZE].value, u.stepSize);
+                settingsChanged |= updateValue(FocuserSettingsN[FS_COMPENSATION].value, u.compStep);
+                settingsChanged |= updateValue(FocuserSettingsN[FS_COMP_THRESHOLD].value, u.compTrigger);
+                settingsChanged |= updateValue(FocuserSettingsN[FS_COMP_CYCLE].value, u.compCycle);
+                settingsChanged |= updateState(FocuserSettingsNP.s, IPS_OK);
+                bool maxChanged = updateValue(FocusMaxPosN[0].value, u.maxPos);
+
+                bool modeChanged = false;
+                modeChanged |= updateSwitch(FocuserCompModeS[FS_COMP_MANUAL].s, (!u.compAuto) ? ISS_ON : ISS_OFF);
+                modeChanged |= updateSwitch(FocuserCompModeS[FS_COMP_AUTO].s, (u.compAuto) ? ISS_ON : ISS_OFF);
+                modeChanged |= updateState(FocuserCompModeSP.s, IPS_OK);
+
+                publish(&FocuserCompModeSP, modeChanged);
+                publish(&FocuserSettingsNP, settingsChanged);
+                publish(&FocusMaxPosNP, maxChanged);
+                break;
             }
 
-            CompensationValueN[0].value = std::stod(result[Q_COMP_DIFF]);
-            CompensateNowSP.s = CompensationValueNP.s = (CompensationValueN[0].value > 0) ? IPS_OK : IPS_IDLE;
-            CompensateNowS[0].s = (CompensationValueN[0].value != 0) ? ISS_OFF : ISS_ON;
-            IDSetNumber(&CompensationValueNP, nullptr);
-            IDSetSwitch(&CompensateNowSP, nullptr);
+            case FocuserLinkEvent::EVENT_F:
+            {
+                verifySettings(event);
+                bool manualChanged = false;
+                manualChanged |= updateSwitch(FocuserManualS[FS_MANUAL_OFF].s, (!event.f.manual) ? ISS_ON : ISS_OFF);
+                manualChanged |= updateSwitch(FocuserManualS[FS_MANUAL_ON].s, (event.f.manual) ? ISS_ON : ISS_OFF);
+                manualChanged |= updateState(FocuserManualSP.s, IPS_OK);
+                publish(&FocuserManualSP, manualChanged);
+                break;
+            }
+
+            case FocuserLinkEvent::EVENT_DONE:
+                io.complete(event);
+                break;
+
+            case FocuserLinkEvent::EVENT_LINK_LOST:
+                // Reopening the port restarts the worker and its event queue. Connect()
+                // returns at once while the device counts as connected, so clear that first.
+                // The handshake waits for the device, it runs from a timer, not from here.
+                LOG_WARN("Link lost, reopening the port.");
+                Disconnect();
+                setConnected(false, IPS_BUSY);
+                reconnectDelay = RECONNECT_FIRST;
+                scheduleReconnect();
+                return true;
+
+            case FocuserLinkEvent::EVENT_SERIAL:
+                logSerial(event.command, event.code, event.arg);
+                break;
+
+            case FocuserLinkEvent::EVENT_FAILED:
+                LOGF_ERROR("Command %c failed.", event.command);
+                dumpTrace("command failed");
+                switch (event.command)
+                {
+                    case 'U':
+                        if (FocuserSettingsNP.s == IPS_BUSY)
+                        {
+                            FocuserSettingsNP.s = IPS_ALERT;
+                            IDSetNumber(&FocuserSettingsNP, nullptr);
+                        }
+                        if (FocuserCompModeSP.s == IPS_BUSY)
+                        {
+                            FocuserCompModeSP.s = IPS_ALERT;
+                            IDSetSwitch(&FocuserCompModeSP, nullptr);
+                        }
+                        break;
+                }
+                break;
         }
     }
 
-    // update settings data if was changed
-    if (FocuserSettingsNP.s != IPS_OK || FocuserCompModeSP.s != IPS_OK)
+    // publishing statistics are refreshed at a low rate, they are not counted
+    if (time(nullptr) - publishStatsTime >= PUBLISH_STATS_PERIOD
+            && (PublishStatsN[PS_SENT].value != publishSent || PublishStatsN[PS_SUPPRESSED].value != publishSuppressed))
     {
-        if (sendCommand("u", res))
-        {
-            std::vector<std::string> result = split(res, ":");
+        publishStatsTime = time(nullptr);
+        PublishStatsN[PS_SENT].value = publishSent;
+        PublishStatsN[PS_SUPPRESSED].value = publishSuppressed;
+        IDSetNumber(&PublishStatsNP, nullptr);
+        metrics.set(METRIC_PUBLISH_SENT, publishSent);
+        metrics.set(METRIC_PUBLISH_SUPPRESSED, publishSuppressed);
+    }
+    if (time(nullptr) - serialStatsTime >= PUBLISH_STATS_PERIOD)
+    {
+        serialStatsTime = time(nullptr);
+        metrics.set(METRIC_EVENTS_DROPPED, io.droppedEvents());
+        updateSerialStats();
+        updateEstimateDrift();
+    }
 
-            FocuserSettingsN[FS_STEP_SIZE].value = std::stod(result[U_STEPSIZE]) / 100.0;
-            FocuserSettingsN[FS_COMPENSATION].value = std::stod(result[U_COMPSTEP]) / 100.0;
-            FocuserSettingsN[FS_COMP_THRESHOLD].value = std::stod(result[U_COMPTRIGGER]);
-            FocusMaxPosN[0].value = std::stod(result[U_MAX_POS]);
-            FocuserSettingsNP.s = IPS_OK;
+    return true;
+}
 
-            FocuserCompModeS[FS_COMP_MANUAL].s = (std::stod(result[U_COMPAUTO]) == 0) ? ISS_ON : ISS_OFF;
-            FocuserCompModeS[FS_COMP_AUTO].s = (std::stod(result[U_COMPAUTO]) > 0) ? ISS_ON : ISS_OFF;
-            FocuserCompModeSP.s = IPS_OK;
+void FocuserLink::updateSerialStats()
+{
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++)
+    {
+        FocuserLinkStats::Summary summary;
+        serialStats.summary(i, summary);
+        // only commands with new traffic are sent again
+        if (SerialStatsN[i][SS_COUNT].value == summary.count && SerialStatsN[i][SS_DISCARDED].value == summary.discarded
+                && SerialStatsNP[i].s != IPS_IDLE)
+            continue;
+
+        SerialStatsN[i][SS_COUNT].value = summary.count;
+        SerialStatsN[i][SS_TIMEOUTS].value = summary.timeouts;
+        SerialStatsN[i][SS_FRAMING].value = summary.framing;
+        SerialStatsN[i][SS_ERRORS].value = summary.errors;
+        SerialStatsN[i][SS_DISCARDED].value = summary.discarded;
+        SerialStatsN[i][SS_P50].value = summary.p50;
+        SerialStatsN[i][SS_P99].value = summary.p99;
+        SerialStatsN[i][SS_MAX].value = summary.max;
+        // late replies skipped on the way are harmless, they do not raise the alert
+        SerialStatsNP[i].s = (summary.timeouts + summary.framing + summary.errors > 0) ? IPS_ALERT : IPS_OK;
+        IDSetNumber(&SerialStatsNP[i], nullptr);
+    }
+}
 
-            IDSetSwitch(&FocuserCompModeSP, nullptr);
-            IDSetNumber(&FocuserSettingsNP, nullptr);
-            IDSetNumber(&FocusMaxPosNP, nullptr);
-        }
+void FocuserLink::updateEstimateDrift()
+{
+    if (EstimateDriftN[ED_LAST].value == estimator.lastDrift() && EstimateDriftN[ED_MAX].value == estimator.maxDrift())
+        return;
+    EstimateDriftN[ED_LAST].value = estimator.lastDrift();
+    EstimateDriftN[ED_EMA].value = estimator.driftEma();
+    EstimateDriftN[ED_MAX].value = estimator.maxDrift();
+    EstimateDriftNP.s = IPS_OK;
+    IDSetNumber(&EstimateDriftNP, nullptr);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Position estimate
+//////////////////////////////////////////////////////////////////////
+void FocuserLink::TimerHit()
+{
+    // published between polls while moving, no serial traffic
+    estimateTimerID = -1;
+    if (!isConnected() || !estimator.moving() || PollingN[PI_ESTIMATE].value <= 0)
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double position = std::round(estimator.position(now));
+    bool posChanged = updateValue(FocusAbsPosN[0].value, position);
+    bool mmChanged = updateValue(FocusPosMMN[0].value, position * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0);
+    bool etaChanged = updateValue(FocusEtaN[0].value, estimator.eta(now), 0.1);
+    publish(&FocusPosMMNP, mmChanged);
+    publish(&FocusAbsPosNP, posChanged);
+    publish(&FocusEtaNP, etaChanged);
+
+    estimateTimerID = SetTimer(PollingN[PI_ESTIMATE].value);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Cached settings
+//////////////////////////////////////////////////////////////////////
+// Settings rarely change outside the driver, so the replies of the last
+// session are published right after the handshake. They stay Idle until the
+// first u and f polls confirm them, differences are reported.
+void FocuserLink::publishCachedSettings()
+{
+    connectTime = std::chrono::steady_clock::now();
+    settingsVerified = manualVerified = false;
+
+    char reply[ASTROLINK4_LEN] = {0};
+    FocuserLinkProtocol::URecord u;
+    if (IUGetConfigText(getDeviceName(), DeviceCacheTP.name, DeviceCacheT[DC_U].name, reply, ASTROLINK4_LEN) == 0
+            && FocuserLinkProtocol::parseU(reply, u))
+    {
+        IUSaveText(&DeviceCacheT[DC_U], reply);
+        FocuserSettingsN[FS_STEP_SIZE].value = u.stepSize;
+        FocuserSettingsN[FS_COMPENSATION].value = u.compStep;
+        FocuserSettingsN[FS_COMP_THRESHOLD].value = u.compTrigger;
+        FocuserSettingsN[FS_COMP_CYCLE].value = u.compCycle;
+        FocusMaxPosN[0].value = u.maxPos;
+        FocuserCompModeS[FS_COMP_MANUAL].s = u.compAuto ? ISS_OFF : ISS_ON;
+        FocuserCompModeS[FS_COMP_AUTO].s = u.compAuto ? ISS_ON : ISS_OFF;
+        FocuserSettingsNP.s = FocuserCompModeSP.s = IPS_IDLE;
+    }
+
+    FocuserLinkProtocol::FRecord f;
+    if (IUGetConfigText(getDeviceName(), DeviceCacheTP.name, DeviceCacheT[DC_F].name, reply, ASTROLINK4_LEN) == 0
+            && FocuserLinkProtocol::parseF(reply, f))
+    {
+        IUSaveText(&DeviceCacheT[DC_F], reply);
+        FocuserManualS[FS_MANUAL_ON].s = f.manual ? ISS_ON : ISS_OFF;
+        FocuserManualS[FS_MANUAL_OFF].s = f.manual ? ISS_OFF : ISS_ON;
+        FocuserManualSP.s = IPS_IDLE;
     }
+}
 
-    if (FocuserManualSP.s != IPS_OK)
+void FocuserLink::verifySettings(const FocuserLinkEvent &event)
+{
+    bool settings = event.type == FocuserLinkEvent::EVENT_U;
+    IText &cached = DeviceCacheT[settings ? DC_U : DC_F];
+    bool &verified = settings ? settingsVerified : manualVerified;
+
+    if (!verified)
     {
-        if (sendCommand("f", res))
+        verified = true;
+        if (cached.text[0] != '\0' && strcmp(cached.text, event.reply))
         {
-            std::vector<std::string> result = split(res, ":");
-            FocuserManualS[FS_MANUAL_OFF].s = (std::stod(result[1]) == 0) ? ISS_ON : ISS_OFF;
-            FocuserManualS[FS_MANUAL_ON].s = (std::stod(result[1]) > 0) ? ISS_ON : ISS_OFF;
-            FocuserManualSP.s = IPS_OK;
-            IDSetSwitch(&FocuserManualSP, nullptr);
+            if (settings)
+            {
+                FocuserLinkProtocol::URecord u;
+                if (FocuserLinkProtocol::parseU(cached.text, u))
+                    LOGF_WARN("Device settings changed since last session: step size %.2f -> %.2f um, "
+                              "compensation %.2f -> %.2f steps/C, threshold %.0f -> %.0f, cycle %.0f -> %.0f s, "
+                              "max position %u -> %u, auto compensation %d -> %d.",
+                              u.stepSize, event.u.stepSize, u.compStep, event.u.compStep, u.compTrigger, event.u.compTrigger,
+                              u.compCycle, event.u.compCycle, u.maxPos, event.u.maxPos, u.compAuto, event.u.compAuto);
+            }
+            else
+                LOGF_WARN("Hand controller changed since last session: %s -> %s.", cached.text, event.reply);
         }
+        if (settingsVerified && manualVerified)
+            LOGF_INFO("Device settings read %.0f ms after connect.",
+                      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - connectTime).count());
+    }
+
+    if (strcmp(cached.text, event.reply))
+    {
+        IUSaveText(&cached, event.reply);
+        // the cache is not a defined property and a single property save only
+        // rewrites elements already in the file, so the whole config is written
+        saveConfig(true);
+        // read it back the way the next handshake will
+        char stored[ASTROLINK4_LEN] = {0};
+        if (IUGetConfigText(getDeviceName(), DeviceCacheTP.name, cached.name, stored, ASTROLINK4_LEN) != 0
+                || strcmp(stored, event.reply))
+            LOGF_WARN("%s could not be cached in the config file, the next connect waits for the device.",
+                      settings ? "Device settings" : "Hand controller state");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Weather
+//////////////////////////////////////////////////////////////////////
+void FocuserLink::filterWeather(const FocuserLinkProtocol::QRecord &q, std::chrono::steady_clock::time_point time)
+{
+    static const char *parameters[] = { "WEATHER_TEMPERATURE", "WEATHER_HUMIDITY", "WEATHER_DEWPOINT" };
+    const double raw[] = { q.sens1Temp, q.sens1Hum, q.sens1Dew };
+    double seconds = std::chrono::duration<double>(time.time_since_epoch()).count();
+    FocuserLinkFilter::Mode mode = static_cast<FocuserLinkFilter::Mode>(IUFindOnSwitchIndex(&WeatherFilterSP));
+
+    bool weatherChanged = false, rawChanged = false, trendsChanged = false;
+    for (int i = 0; i < 3; i++)
+    {
+        FocuserLinkFilter &filter = weatherFilters[i];
+        double deadband = DeadbandN[i].value;
+        filter.add(seconds, raw[i]);
+        weatherChanged |= updateParameter(parameters[i], filter.value(mode), deadband);
+        rawChanged |= updateValue(WeatherRawN[i].value, raw[i], deadband);
+        trendsChanged |= updateValue(WeatherTrendsN[i * WT_N + WT_MIN].value, filter.min(), deadband);
+        trendsChanged |= updateValue(WeatherTrendsN[i * WT_N + WT_MAX].value, filter.max(), deadband);
+        trendsChanged |= updateValue(WeatherTrendsN[i * WT_N + WT_RATE].value, filter.rate(), deadband);
+    }
+    rawChanged |= updateState(WeatherRawNP.s, IPS_OK);
+    trendsChanged |= updateState(WeatherTrendsNP.s, IPS_OK);
+    publish(&ParametersNP, weatherChanged);
+    publish(&WeatherRawNP, rawChanged);
+    publish(&WeatherTrendsNP, trendsChanged);
+
+    compTemperature = (CompTemperatureS[CTS_FILTERED].s == ISS_ON) ? weatherFilters[DB_TEMPERATURE].value(mode) : q.sens1Temp;
+
+    metrics.set(METRIC_TEMPERATURE, q.sens1Temp);
+    metrics.set(METRIC_TEMPERATURE_FILTERED, weatherFilters[DB_TEMPERATURE].value(mode));
+    metrics.set(METRIC_HUMIDITY, q.sens1Hum);
+    metrics.set(METRIC_DEWPOINT, q.sens1Dew);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Telemetry
+//////////////////////////////////////////////////////////////////////
+void FocuserLink::recordTelemetry(const FocuserLinkProtocol::QRecord &q)
+{
+    // environment fields are not read on every poll, the last values are kept
+    telemetrySample.timeMs = FocuserLinkTelemetry::nowMs();
+    telemetrySample.position = q.stepperPos;
+    telemetrySample.stepsToGo = q.stepsToGo;
+    if (q.hasEnvironment)
+    {
+        bool sensor = q.sens1Type > 0;
+        telemetrySample.temperature = sensor ? q.sens1Temp : NAN;
+        telemetrySample.humidity = sensor ? q.sens1Hum : NAN;
+        telemetrySample.dewPoint = sensor ? q.sens1Dew : NAN;
+        telemetrySample.compDiff = q.compDiff;
+    }
+    telemetry.record(telemetrySample);
+}
+
+void FocuserLink::exportTelemetry()
+{
+    int64_t now = FocuserLinkTelemetry::nowMs();
+    int64_t from = now - static_cast<int64_t>(TelemetryWindowN[TW_FROM].value * 60000);
+    int64_t to = now - static_cast<int64_t>(TelemetryWindowN[TW_TO].value * 60000);
+    size_t rows = telemetry.exportCsv(from, to, telemetryCsv);
+
+    TelemetryCsvB[0].blob = const_cast<char *>(telemetryCsv.data());
+    TelemetryCsvB[0].bloblen = TelemetryCsvB[0].size = telemetryCsv.size();
+    TelemetryCsvBP.s = IPS_OK;
+    IDSetBLOB(&TelemetryCsvBP, nullptr);
+
+    TelemetryExportS[0].s = ISS_OFF;
+    TelemetryExportSP.s = IPS_OK;
+    IDSetSwitch(&TelemetryExportSP, "Exported %zu telemetry samples.", rows);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Trace
+//////////////////////////////////////////////////////////////////////
+void FocuserLink::exportTrace()
+{
+    size_t lines = trace.dump(traceText);
+
+    TraceB[0].blob = const_cast<char *>(traceText.data());
+    TraceB[0].bloblen = TraceB[0].size = traceText.size();
+    TraceBP.s = IPS_OK;
+    IDSetBLOB(&TraceBP, nullptr);
+
+    TraceDumpS[0].s = ISS_OFF;
+    TraceDumpSP.s = IPS_OK;
+    IDSetSwitch(&TraceDumpSP, "Dumped %zu trace entries.", lines);
+}
+
+void FocuserLink::dumpTrace(const char *reason)
+{
+    // INDI thread only, the reactor side posts its failures as EVENT_SERIAL
+    time_t now = time(nullptr);
+    if (now - traceDumpTime < TRACE_ERROR_HOLDOFF)
+        return;
+    traceDumpTime = now;
+
+    std::string text;
+    trace.dump(text, TRACE_ERROR_ENTRIES);
+    LOGF_WARN("Trace before %s:\n%s", reason, text.c_str());
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Compensation model
+//////////////////////////////////////////////////////////////////////
+void FocuserLink::learnFocus(const FocuserLinkProtocol::QRecord &q, IPState motionState)
+{
+    if (!focusCandidate)
+        return;
+    if (motionState != IPS_OK)
+    {
+        candidateIdle = false;
+        return;
     }
 
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!candidateIdle)
+    {
+        candidateIdle = true;
+        candidateSince = now;
+        candidatePosition = q.stepperPos;
+        return;
+    }
+    // moved by the hand controller or the device compensation, not a focus result
+    if (q.stepperPos != candidatePosition)
+    {
+        focusCandidate = false;
+        return;
+    }
+    if (now - candidateSince >= std::chrono::seconds(static_cast<int>(CompModelOptionsN[CMO_SETTLE].value)))
+    {
+        focusCandidate = false;
+        acceptFocus();
+    }
+}
+
+bool FocuserLink::acceptFocus()
+{
+    if (std::isnan(compTemperature))
+    {
+        LOG_WARN("No temperature reading, focus position is not used for the compensation model.");
+        return false;
+    }
+    compModel.add(compTemperature, hardwarePosition, currentFilter);
+    LOGF_DEBUG("Focus %d at %.2f C added to the compensation model.", hardwarePosition, compTemperature);
+    updateCompModel();
+    return true;
+}
+
+void FocuserLink::updateCompModel()
+{
+    FocuserLinkCompModel::Fit fit = compModel.fit(CompModelTermsS[CMT_PER_FILTER].s == ISS_ON);
+    CompModelN[CM_SLOPE].value = fit.slope;
+    CompModelN[CM_R2].value = fit.r2;
+    CompModelN[CM_STDERR].value = fit.stdErr;
+    CompModelN[CM_SAMPLES].value = fit.samples;
+    CompModelN[CM_SPREAD].value = fit.tempSpread;
+
+    bool good = fit.valid && fit.r2 >= CompModelOptionsN[CMO_MIN_R2].value;
+    CompModelNP.s = !fit.valid ? IPS_IDLE : good ? IPS_OK : IPS_ALERT;
+    IDSetNumber(&CompModelNP, nullptr);
+
+    if (good && CompModelModeS[CMM_AUTO].s == ISS_ON
+            && std::fabs(fit.slope - FocuserSettingsN[FS_COMPENSATION].value) >= COMP_APPLY_DELTA)
+        applyCompSlope(fit.slope);
+}
+
+bool FocuserLink::applyCompSlope(double slope)
+{
+    // the device moves compStep steps per degree of temperature rise, same sign as the fit
+    if (!updateSetting<&FocuserLinkProtocol::URecord::compStep>(slope))
+        return false;
+    LOGF_INFO("Compensation set to %.2f steps/C from %.0f focus positions (R squared %.3f).", slope,
+              CompModelN[CM_SAMPLES].value, CompModelN[CM_R2].value);
+    FocuserSettingsNP.s = IPS_BUSY;
+    IDSetNumber(&FocuserSettingsNP, nullptr);
     return true;
 }
 
 //////////////////////////////////////////////////////////////////////
-/// Helper functions
+/// Filter offsets
 //////////////////////////////////////////////////////////////////////
-std::vector<std::string> FocuserLink::split(const std::string &input, const std::string &regex)
+// Wheels that publish the new slot together with the busy state get the
+// focuser moving while they still turn, others when they report the slot.
+void FocuserLink::filterSlotChanged()
 {
-    // passing -1 as the submatch index parameter performs splitting
-    std::regex re(regex);
-    std::sregex_token_iterator
-        first{input.begin(), input.end(), re, -1},
-        last;
-    return {first, last};
+    int slot = static_cast<int>(FilterSlotN[0].value);
+    if (slot < 1 || slot > FILTER_OFFSET_SLOTS || slot == offsetSlot)
+        return;
+
+    currentFilter = slot - 1;
+    int previous = offsetSlot;
+    offsetSlot = slot;
+    // the position the focuser is at belongs to the first slot seen
+    if (previous == 0 || !isConnected() || FilterOffsetModeS[FOM_ON].s != ISS_ON)
+        return;
+
+    int32_t delta = FilterOffsetN[slot - 1].value - FilterOffsetN[previous - 1].value;
+    if (delta == 0)
+        return;
+    if (FocusAbsPosNP.s == IPS_BUSY)
+    {
+        LOGF_WARN("Focuser is moving, offset of %d steps for filter slot %d not applied.", delta, slot);
+        return;
+    }
+
+    int32_t target = std::max(0, std::min(hardwarePosition + delta, static_cast<int32_t>(FocusMaxPosN[0].value)));
+    LOGF_INFO("Filter slot %d: moving focuser by %d steps to %d.", slot, delta, target);
+    // an offset move is no focus decision for the compensation model
+    FocusAbsPosNP.s = moveFocuser(target);
+    IDSetNumber(&FocusAbsPosNP, nullptr);
 }
 
-std::string FocuserLink::doubleToStr(double val)
+//////////////////////////////////////////////////////////////////////
+/// Publishing
+//////////////////////////////////////////////////////////////////////
+// Property values and states are only assigned when they differ from what
+// clients have already seen, the caller collects the result as dirty flag.
+bool FocuserLink::updateValue(double &target, double value, double deadband)
 {
-    char buf[10];
-    sprintf(buf, "%.0f", val);
-    return std::string(buf);
+    if ((deadband > 0) ? std::fabs(target - value) <= deadband : target == value)
+        return false;
+    target = value;
+    return true;
+}
+
+bool FocuserLink::updateState(IPState &target, IPState state)
+{
+    if (target == state)
+        return false;
+    target = state;
+    return true;
+}
+
+bool FocuserLink::updateSwitch(ISState &target, ISState state)
+{
+    if (target == state)
+        return false;
+    target = state;
+    return true;
 }
 
-bool FocuserLink::updateSettings(const char *getCom, const char *setCom, int index, const char *value)
+bool FocuserLink::updateParameter(const char *name, double value, double deadband)
 {
-    std::map<int, std::string> values;
-    values[index] = value;
-    return updateSettings(getCom, setCom, values);
+    INumber *parameter = IUFindNumber(&ParametersNP, name);
+    return parameter != nullptr && updateValue(parameter->value, value, deadband);
 }
 
-bool FocuserLink::updateSettings(const char *getCom, const char *setCom, std::map<int, std::string> values)
+void FocuserLink::publish(INumberVectorProperty *nvp, bool changed)
 {
-    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
-    snprintf(cmd, ASTROLINK4_LEN, "%s", getCom);
-    if (sendCommand(cmd, res))
+    if (changed)
     {
-        std::string concatSettings = "";
-        std::vector<std::string> result = split(res, ":");
-        if (result.size() >= values.size())
-        {
-            result[0] = setCom;
-            for (std::map<int, std::string>::iterator it = values.begin(); it != values.end(); ++it)
-                result[it->first] = it->second;
-
-            for (const auto &piece : result)
-                concatSettings += piece + ":";
-            snprintf(cmd, ASTROLINK4_LEN, "%s", concatSettings.c_str());
-            if (sendCommand(cmd, res))
-                return true;
-        }
+        IDSetNumber(nvp, nullptr);
+        publishSent++;
+    }
+    else
+        publishSuppressed++;
+}
+
+void FocuserLink::publish(ISwitchVectorProperty *svp, bool changed)
+{
+    if (changed)
+    {
+        IDSetSwitch(svp, nullptr);
+        publishSent++;
     }
-    return false;
+    else
+        publishSuppressed++;
 }
@@ -25,33 +25,46 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <poll.h>
+#include <cerrno>
 #include <memory>
-#include <regex>
+#include <vector>
+#include <algorithm>
 #include <cstring>
 #include <map>
 #include <sstream>
+#include <cmath>
+#include <ctime>
+#include <chrono>
 
 #include <defaultdevice.h>
 #include <indifocuserinterface.h>
 #include <indiweatherinterface.h>
 #include <connectionplugins/connectionserial.h>
 
-#define Q_STEPPER_POS		1
-#define Q_STEPS_TO_GO		2
-#define Q_SENS1_TYPE		3
-#define Q_SENS1_TEMP		4
-#define Q_SENS1_HUM			5
-#define Q_SENS1_DEW			6
-#define Q_COMP_DIFF			7
+#include "focuserlink_protocol.h"
+#include "focuserlink_io.h"
+#include "focuserlink_client.h"
+#include "focuserlink_transport.h"
+#include "focuserlink_stats.h"
+#include "focuserlink_port.h"
+#include "focuserlink_telemetry.h"
+#include "focuserlink_compmodel.h"
+#include "focuserlink_estimator.h"
+#include "focuserlink_transcript.h"
+#include "focuserlink_trace.h"
+#include "focuserlink_filter.h"
+#include "focuserlink_metrics.h"
 
-#define U_MAX_POS			5
-#define U_REVERSED			6
-#define U_STEPSIZE			7
-#define U_COMPSTEP          8
-#define U_COMPCYCLE         9
-#define U_COMPTRIGGER       10
-#define U_COMPAUTO          11
+// controllers hosted by one driver process
+#define FOCUSERLINK_MAX_UNITS 16
 
+// [ms] first reconnect attempt after a lost link, doubled up to the maximum
+#define RECONNECT_FIRST 1000
+#define RECONNECT_MAX   30000
+
+// filter wheel slots with a focus offset, same numbering as the compensation model
+#define FILTER_OFFSET_SLOTS COMP_MODEL_FILTERS
 
 namespace Connection
 {
@@ -62,19 +75,20 @@ class FocuserLink : public INDI::DefaultDevice, public INDI::FocuserInterface, p
 {
 
 public:
-    FocuserLink();
+    explicit FocuserLink(int unit = 0, const char *defaultPort = nullptr);
     virtual bool initProperties();
     virtual bool updateProperties();
 	
     virtual bool ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n);
     virtual bool ISNewSwitch (const char *dev, const char *name, ISState *states, char *names[], int n);
     virtual bool ISNewText(const char * dev, const char * name, char * texts[], char * names[], int n);
+    virtual bool ISSnoopDevice(XMLEle *root) override;
+    virtual bool Disconnect() override;
+    virtual void TimerHit() override;
 	
 protected:
     virtual const char *getDefaultName();
-    virtual void TimerHit();
     virtual bool saveConfigItems(FILE *fp);
-    virtual bool sendCommand(const char * cmd, char * res);
 
     // Focuser Overrides
     virtual IPState MoveAbsFocuser(uint32_t targetTicks) override;
@@ -98,20 +112,109 @@ private:
     virtual bool Handshake();
     int PortFD = -1;
     Connection::Serial *serialConnection { nullptr };
-    bool updateSettings(const char * getCom, const char * setCom, int index, const char * value);
-    bool updateSettings(const char * getCom, const char * setCom, std::map<int, std::string> values);
-    std::vector<std::string> split(const std::string &input, const std::string &regex);
-    std::string doubleToStr(double val);
+    std::string defaultPort;
+    // single settings field, written by the I/O worker with the next U command
+    template <auto Member, typename T>
+    bool updateSetting(T value)
+    {
+        FocuserLinkSchema::SettingsPatch patch;
+        return patch.set<Member>(value) && io.submitSettings(patch);
+    }
     bool sensorRead();
-    int32_t calculateBacklash(uint32_t targetTicks);
-    char stopChar { 0xA };	// new line
+    void setClientHooks();
+    void motionDone(bool ok);
+    IPState moveFocuser(uint32_t targetTicks);
+    void updateSerialStats();
+    void updateEstimateDrift();
+    void recordTelemetry(const FocuserLinkProtocol::QRecord &q);
+    void exportTelemetry();
+    void exportTrace();
+    void dumpTrace(const char *reason);
+    void serialNote(char command, int note, int arg);
+    void logSerial(char command, int note, int arg);
+    void learnFocus(const FocuserLinkProtocol::QRecord &q, IPState motionState);
+    bool acceptFocus();
+    void updateCompModel();
+    bool applyCompSlope(double slope);
+    void filterSlotChanged();
+    void publishCachedSettings();
+    void verifySettings(const FocuserLinkEvent &event);
+    void filterWeather(const FocuserLinkProtocol::QRecord &q, std::chrono::steady_clock::time_point time);
+    static void ioCallback(int fd, void *arg);
+    void scheduleReconnect();
+    void reconnect();
+    static void reconnectCallback(void *arg);
+    bool updateValue(double &target, double value, double deadband = 0);
+    bool updateState(IPState &target, IPState state);
+    bool updateSwitch(ISState &target, ISState state);
+    bool updateParameter(const char *name, double value, double deadband);
+    void publish(INumberVectorProperty *nvp, bool changed);
+    void publish(ISwitchVectorProperty *svp, bool changed);
     bool backlashEnabled = false;
     int32_t backlashSteps = 0;
-    bool requireBacklashReturn = false;
+
+    // the INDI serial connection owns the port, simulation answers in process
+    FocuserLinkSerialTransport serialLine;
+    FocuserLinkMemoryTransport simulatedLine;
+    FocuserLinkClient client;
+    FocuserLinkIO &io { client.session() };
+    int ioCallbackID = -1;
+    int reconnectTimerID = -1;
+    int reconnectDelay = RECONNECT_FIRST;
+
+    unsigned long publishSent = 0;
+    unsigned long publishSuppressed = 0;
+    time_t publishStatsTime = 0;
+
+    FocuserLinkStats &serialStats { client.stats() };
+    time_t serialStatsTime = 0;
+
+    FocuserLinkMetrics metrics { serialStats };
+    std::chrono::steady_clock::time_point lastPollTime;
+
+    FocuserLinkTranscriptWriter transcript;
+
+    // u and f replies of the last session are shown at connect until the device confirms them
+    bool settingsVerified = false;
+    bool manualVerified = false;
+    std::chrono::steady_clock::time_point connectTime;
+
+    FocuserLinkTrace trace;
+    std::string traceText;
+    // [s] last automatic dump, errors repeating on every poll dump once
+    time_t traceDumpTime = 0;
+
+    FocuserLinkTelemetry telemetry;
+    FocuserLinkSample telemetrySample;
+    std::string telemetryCsv;
+
+    FocuserLinkEstimator estimator;
+    int estimateTimerID = -1;
+    // last position the controller reported, FocusAbsPosN carries the
+    // estimate while moving; moves, syncs and the model start from this one
+    int32_t hardwarePosition = 0;
+
+    // one per weather channel, in DB_* order
+    FocuserLinkFilter weatherFilters[3];
+
+    FocuserLinkCompModel compModel;
+    // [C] input of the compensation model, NaN without sensor
+    double compTemperature = NAN;
+    int currentFilter = 0;
+    // last client absolute move, taken as accepted focus once it stayed put for the settle time
+    bool focusCandidate = false;
+    bool candidateIdle = false;
+    std::chrono::steady_clock::time_point candidateSince;
+    int32_t candidatePosition = 0;
+    // wheel slot whose offset the focuser position includes, 0 before the first snoop
+    int offsetSlot = 0;
 
     INumber FocusPosMMN[1];
     INumberVectorProperty FocusPosMMNP;
 
+    INumber FocusEtaN[1];
+    INumberVectorProperty FocusEtaNP;
+
     INumber CompensationValueN[1];
     INumberVectorProperty CompensationValueNP;
     ISwitch CompensateNowS[1];
@@ -121,7 +224,59 @@ private:
     INumberVectorProperty FocuserSettingsNP;
     enum
     {
-        FS_STEP_SIZE, FS_COMPENSATION, FS_COMP_THRESHOLD
+        FS_STEP_SIZE, FS_COMPENSATION, FS_COMP_THRESHOLD, FS_COMP_CYCLE
+    };
+
+    INumber CompModelN[5];
+    INumberVectorProperty CompModelNP;
+    enum
+    {
+        CM_SLOPE, CM_R2, CM_STDERR, CM_SAMPLES, CM_SPREAD
+    };
+
+    INumber CompModelOptionsN[2];
+    INumberVectorProperty CompModelOptionsNP;
+    enum
+    {
+        CMO_SETTLE, CMO_MIN_R2
+    };
+
+    ISwitch CompModelModeS[2];
+    ISwitchVectorProperty CompModelModeSP;
+    enum
+    {
+        CMM_PROPOSE, CMM_AUTO
+    };
+
+    ISwitch CompModelTermsS[2];
+    ISwitchVectorProperty CompModelTermsSP;
+    enum
+    {
+        CMT_COMMON, CMT_PER_FILTER
+    };
+
+    ISwitch CompModelActionS[3];
+    ISwitchVectorProperty CompModelActionSP;
+    enum
+    {
+        CMA_ACCEPT, CMA_APPLY, CMA_RESET
+    };
+
+    IText FilterWheelT[1] {};
+    ITextVectorProperty FilterWheelTP;
+
+    // snooped from the filter wheel, not defined
+    INumber FilterSlotN[1];
+    INumberVectorProperty FilterSlotNP;
+
+    INumber FilterOffsetN[FILTER_OFFSET_SLOTS];
+    INumberVectorProperty FilterOffsetNP;
+
+    ISwitch FilterOffsetModeS[2];
+    ISwitchVectorProperty FilterOffsetModeSP;
+    enum
+    {
+        FOM_ON, FOM_OFF
     };
 
     ISwitch FocuserCompModeS[2];
@@ -138,11 +293,125 @@ private:
     FS_MANUAL_ON, FS_MANUAL_OFF
     };
 
+    INumber PollingN[5];
+    INumberVectorProperty PollingNP;
+    enum
+    {
+        PI_MOVING, PI_IDLE, PI_ENVIRONMENT, PI_SETTINGS, PI_ESTIMATE
+    };
+
+    INumber DeadbandN[3];
+    INumberVectorProperty DeadbandNP;
+    enum
+    {
+        DB_TEMPERATURE, DB_HUMIDITY, DB_DEWPOINT
+    };
+
+    ISwitch WeatherFilterS[3];
+    ISwitchVectorProperty WeatherFilterSP;
+    enum
+    {
+        WFM_RAW, WFM_EMA, WFM_MEDIAN
+    };
+
+    INumber WeatherFilterOptionsN[2];
+    INumberVectorProperty WeatherFilterOptionsNP;
+    enum
+    {
+        WFO_ALPHA, WFO_WINDOW
+    };
+
+    INumber WeatherRawN[3];
+    INumberVectorProperty WeatherRawNP;
+
+    // minimum, maximum and rate per channel, in DB_* order
+    INumber WeatherTrendsN[3 * 3];
+    INumberVectorProperty WeatherTrendsNP;
+    enum
+    {
+        WT_MIN, WT_MAX, WT_RATE, WT_N
+    };
+
+    ISwitch CompTemperatureS[2];
+    ISwitchVectorProperty CompTemperatureSP;
+    enum
+    {
+        CTS_RAW, CTS_FILTERED
+    };
+
+    INumber PublishStatsN[2];
+    INumberVectorProperty PublishStatsNP;
+    enum
+    {
+        PS_SENT, PS_SUPPRESSED
+    };
+
+    // EVENT_SERIAL codes posted by the client hooks, arg is errno or the failure count
+    enum
+    {
+        SN_TIMEOUT, SN_FRAMING, SN_ERROR, SN_RESYNC, SN_LINK_LOST
+    };
+
+    INumber SerialStatsN[STATS_COMMAND_COUNT][8];
+    INumberVectorProperty SerialStatsNP[STATS_COMMAND_COUNT];
+    enum
+    {
+        SS_COUNT, SS_TIMEOUTS, SS_FRAMING, SS_ERRORS, SS_DISCARDED, SS_P50, SS_P99, SS_MAX, SS_N
+    };
+
+    INumber EstimateDriftN[3];
+    INumberVectorProperty EstimateDriftNP;
+    enum
+    {
+        ED_LAST, ED_EMA, ED_MAX
+    };
+
+    ISwitch StatsResetS[1];
+    ISwitchVectorProperty StatsResetSP;
+
+    ISwitch TraceDumpS[1];
+    ISwitchVectorProperty TraceDumpSP;
+
+    IBLOB TraceB[1];
+    IBLOBVectorProperty TraceBP;
+
+    // last u and f replies, kept in the config only
+    IText DeviceCacheT[2] {};
+    ITextVectorProperty DeviceCacheTP;
+    enum
+    {
+        DC_U, DC_F
+    };
+
+    IText MetricsSocketT[1] {};
+    ITextVectorProperty MetricsSocketTP;
+
+    IText TranscriptT[1] {};
+    ITextVectorProperty TranscriptTP;
+
+    IText TelemetryLogT[1] {};
+    ITextVectorProperty TelemetryLogTP;
+
+    INumber TelemetryWindowN[2];
+    INumberVectorProperty TelemetryWindowNP;
+    enum
+    {
+        TW_FROM, TW_TO
+    };
+
+    ISwitch TelemetryExportS[1];
+    ISwitchVectorProperty TelemetryExportSP;
+
+    IBLOB TelemetryCsvB[1];
+    IBLOBVectorProperty TelemetryCsvBP;
+
     ISwitch BuzzerS[1];
     ISwitchVectorProperty BuzzerSP;
     
     static constexpr const char *ENVIRONMENT_TAB {"Environment"};
     static constexpr const char *SETTINGS_TAB {"Settings"};
+    static constexpr const char *DIAGNOSTICS_TAB {"Diagnostics"};
+    static constexpr const char *FILTERS_TAB {"Filters"};
 };
 
 #endif